@@ -1,15 +1,19 @@
 #include "forth.h"
 
 // Global structures - Core data structures for the Forth interpreter
-Stack data_stack = {{0}, -1};        // Main data stack for computation
-Stack return_stack = {{0}, -1};      // Return stack for control flow and loops
-Dictionary dict = {{NULL}, 0};       // Dictionary containing all defined words
+__thread Stack data_stack = {{0}, -1};   // Main data stack for computation (one per thread)
+__thread Stack return_stack = {{0}, -1}; // Return stack for control flow and loops
+__thread Stack frame_stack = {{0}, -1};  // Frame slots of active user-defined word calls
+__thread long error_count = 0;           // Errors reported on this thread
+Dictionary dict = {{NULL}, 0, NULL, NULL, NULL, 1, {0}, PTHREAD_MUTEX_INITIALIZER}; // All defined words
 Cell memory[STACK_SIZE] = {0};       // Linear memory space for variables and data
 Cell code_buffer[STACK_SIZE] = {0};  // Temporary buffer for compiling user-defined words
 int base = 10;                       // Number base for input/output (default decimal)
 int state = 0;                       // Interpreter state: 0=interpreting, 1=compiling
 int code_sp = 0;                     // Code buffer stack pointer during compilation
 Word *current_word = NULL;           // Pointer to word currently being compiled
+Word *does_definer = NULL;           // Defining word whose DOES> behaviour is being compiled
+int vm_backend = BACKEND_STACK;      // Global execution backend for user-defined words
 int next_mem_addr = 0;               // Next available address in memory array
 
 // Input handling - Variables for parsing input text
@@ -82,6 +86,58 @@ int stack_full(void)
     return data_stack.sp >= STACK_SIZE - 1;
 }
 
+/**
+ * Check the data stack before a word rewrites its top items in place
+ * @param in Number of items the word consumes
+ * @param out Number of items it leaves in their place
+ * @return 1 if both fit, 0 after reporting underflow or overflow
+ */
+int stack_check(int in, int out)
+{
+    if (data_stack.sp + 1 < in)
+    {
+        error("Stack underflow");
+        return 0;
+    }
+    if (data_stack.sp - in + out >= STACK_SIZE)
+    {
+        error("Stack overflow");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Push a copy of the n-th item below the top of the data stack (0 = top)
+ * @param n Depth of the item to copy
+ */
+void stack_pick(Cell n)
+{
+    if (n < 0 || n > data_stack.sp)
+    {
+        error("Stack underflow");
+        return;
+    }
+    stack_push(data_stack.stack[data_stack.sp - n]);
+}
+
+/**
+ * Remove r items below the top n items of the data stack
+ * @param r Number of items to remove
+ * @param n Number of top items to keep
+ */
+void stack_slide(Cell r, Cell n)
+{
+    if (r < 0 || n < 0 || r + n > data_stack.sp + 1)
+    {
+        error("Stack underflow");
+        return;
+    }
+    Cell *top = &data_stack.stack[data_stack.sp - n + 1];
+    memmove(top - r, top, n * sizeof(Cell));
+    data_stack.sp -= r;
+}
+
 // Return stack operations - Functions for manipulating the return stack (used for loops and control flow)
 
 /**
@@ -203,6 +259,13 @@ int branch_stack_empty(void)
 }
 
 // Dictionary operations - Functions for managing the word dictionary
+//
+// Names are looked up in an open-addressed hash table; dict.words keeps the definition
+// order. Words are only ever added, so a reader that probes a table concurrently with an
+// insertion sees either the new word or a free slot. When a table fills up, the definer
+// publishes a copy twice the size and retires the old one. Each thread records the epoch
+// it is looking up in; a retired table is freed once no thread is still in an epoch from
+// before its replacement. Definers take dict.lock, lookups never do.
 
 /**
  * Initialize the dictionary structure
@@ -213,6 +276,147 @@ void dict_init(void)
     dict.count = 0;
     // Initialize built-in words here later
     memset(dict.words, 0, sizeof(dict.words));
+    dict.table = dict_table_new(DICT_TABLE_MIN);
+    dict.xts = dict_table_new(DICT_TABLE_MIN);
+}
+
+/**
+ * Hash a word name (FNV-1a)
+ * @param name The name
+ * @return Its hash
+ */
+unsigned dict_hash(const char *name)
+{
+    unsigned h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+/**
+ * Allocate an empty hash table
+ * @param size Slots (a power of two)
+ * @return The table, or NULL if out of memory
+ */
+DictTable *dict_table_new(int size)
+{
+    DictTable *table = calloc(1, sizeof(DictTable) + size * sizeof(Word *));
+    if (table)
+        table->size = size;
+    return table;
+}
+
+/**
+ * Add a word to a hash table, publishing it to concurrent readers
+ * The first word defined under a name keeps it, as with a search in definition order
+ * @param table A table with a free slot
+ * @param word The word
+ */
+void dict_table_insert(DictTable *table, Word *word)
+{
+    unsigned mask = table->size - 1;
+    for (unsigned k = dict_hash(word->name) & mask;; k = (k + 1) & mask)
+    {
+        Word *w = table->slots[k];
+        if (!w)
+        {
+            __atomic_store_n(&table->slots[k], word, __ATOMIC_RELEASE);
+            table->count++;
+            return;
+        }
+        if (strcmp(w->name, word->name) == 0)
+            return;
+    }
+}
+
+/**
+ * Hash a word's address, for the table of execution tokens
+ * @param word The word
+ * @return Its hash
+ */
+unsigned xt_hash(const Word *word)
+{
+    return (unsigned)(((unsigned long long)(uintptr_t)word * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/**
+ * Add a word to the table of execution tokens, publishing it to concurrent readers
+ * @param table A table with a free slot
+ * @param word The word (not in the table yet)
+ */
+void xt_table_insert(DictTable *table, Word *word)
+{
+    unsigned mask = table->size - 1;
+    unsigned k = xt_hash(word) & mask;
+    while (table->slots[k])
+        k = (k + 1) & mask;
+    __atomic_store_n(&table->slots[k], word, __ATOMIC_RELEASE);
+    table->count++;
+}
+
+/**
+ * Make room for one more word, publishing a larger copy of a table when it would be more
+ * than half full
+ * The name table is retired until no reader can see it; execution token tables are read
+ * without announcing an epoch, so each new one keeps the one it replaced (half its size)
+ * Called by the definer holding dict.lock
+ * @param slot &dict.table or &dict.xts
+ * @param insert How words are hashed into that table
+ * @return 1 on success, 0 after reporting an error
+ */
+int dict_table_reserve(DictTable **slot, void (*insert)(DictTable *table, Word *word))
+{
+    DictTable *table = *slot;
+    if (2 * (table->count + 1) <= table->size)
+        return 1;
+    DictTable *bigger = dict_table_new(2 * table->size);
+    if (!bigger)
+    {
+        error("Memory allocation failed");
+        return 0;
+    }
+    for (int k = 0; k < table->size; k++)
+        if (table->slots[k])
+            insert(bigger, table->slots[k]);
+    __atomic_store_n(slot, bigger, __ATOMIC_SEQ_CST);
+    if (slot == &dict.xts)
+    {
+        bigger->next = table;
+        return 1;
+    }
+    table->retired = __atomic_add_fetch(&dict.epoch, 1, __ATOMIC_SEQ_CST);
+    table->next = dict.retired;
+    dict.retired = table;
+    return 1;
+}
+
+/**
+ * Free the retired tables that no thread can still be reading
+ * Called by the definer holding dict.lock
+ */
+void dict_reclaim(void)
+{
+    long oldest = __atomic_load_n(&dict.epoch, __ATOMIC_SEQ_CST);
+    for (int k = 0; k < POOL_MAX_THREADS; k++)
+    {
+        long e = __atomic_load_n(&dict.readers[k], __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    DictTable **link = &dict.retired;
+    while (*link)
+    {
+        DictTable *table = *link;
+        if (table->retired <= oldest)
+        {
+            *link = table->next;
+            free(table);
+        }
+        else
+        {
+            link = &table->next;
+        }
+    }
 }
 
 /**
@@ -222,15 +426,26 @@ void dict_init(void)
  */
 Word *dict_find(const char *name)
 {
-    // Simple linear search for now; optimize with hash later
-    for (int i = 0; i < dict.count; i++)
+    // Announce the epoch before reading the table, so that a definer replacing it
+    // afterwards keeps it until this lookup is done
+    long *reader = &dict.readers[pool_id];
+    __atomic_store_n(reader, __atomic_load_n(&dict.epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+    DictTable *table = __atomic_load_n(&dict.table, __ATOMIC_SEQ_CST);
+    Word *found = NULL;
+    unsigned mask = table->size - 1;
+    for (unsigned k = dict_hash(name) & mask;; k = (k + 1) & mask)
     {
-        if (strcmp(dict.words[i]->name, name) == 0)
+        Word *w = __atomic_load_n(&table->slots[k], __ATOMIC_ACQUIRE);
+        if (!w)
+            break;
+        if (strcmp(w->name, name) == 0)
         {
-            return dict.words[i];
+            found = w;
+            break;
         }
     }
-    return NULL;
+    __atomic_store_n(reader, 0, __ATOMIC_RELEASE);
+    return found;
 }
 
 /**
@@ -239,12 +454,339 @@ Word *dict_find(const char *name)
  */
 void dict_add(Word *word)
 {
+    pthread_mutex_lock(&dict.lock);
     if (dict.count >= DICT_SIZE)
     {
+        pthread_mutex_unlock(&dict.lock);
         error("Dictionary full");
         return;
     }
-    dict.words[dict.count++] = word;
+
+    // Keep the tables at most half full
+    if (!dict_table_reserve(&dict.table, dict_table_insert) || !dict_table_reserve(&dict.xts, xt_table_insert))
+    {
+        pthread_mutex_unlock(&dict.lock);
+        return;
+    }
+
+    dict_table_insert(dict.table, word);
+    xt_table_insert(dict.xts, word);
+    dict.words[dict.count] = word;
+    __atomic_store_n(&dict.count, dict.count + 1, __ATOMIC_RELEASE);
+    if (dict.retired)
+        dict_reclaim();
+    pthread_mutex_unlock(&dict.lock);
+}
+
+/**
+ * Make a word that is not in the dictionary, such as a quotation, a valid execution token
+ * @param word The word
+ * @return 1 on success, 0 after reporting an error
+ */
+int xt_add(Word *word)
+{
+    pthread_mutex_lock(&dict.lock);
+    int ok = dict_table_reserve(&dict.xts, xt_table_insert);
+    if (ok)
+        xt_table_insert(dict.xts, word);
+    pthread_mutex_unlock(&dict.lock);
+    return ok;
+}
+
+/**
+ * Check whether a cell is the execution token of a word or quotation, without dereferencing it
+ * @param xt The cell
+ * @return The word, or NULL if xt is not one
+ */
+Word *xt_find(Cell xt)
+{
+    // Replaced tables are never freed, so no epoch needs to be announced
+    DictTable *table = __atomic_load_n(&dict.xts, __ATOMIC_ACQUIRE);
+    unsigned mask = table->size - 1;
+    for (unsigned k = xt_hash((Word *)xt) & mask;; k = (k + 1) & mask)
+    {
+        Word *w = __atomic_load_n(&table->slots[k], __ATOMIC_ACQUIRE);
+        if (!w || (Cell)w == xt)
+            return w;
+    }
+}
+
+/**
+ * Find the dictionary entry of a built-in word by its implementation
+ * @param func The built-in's function
+ * @return The word, or NULL if it is not in the dictionary
+ */
+Word *dict_find_builtin(void (*func)())
+{
+    int count = __atomic_load_n(&dict.count, __ATOMIC_ACQUIRE);
+    for (int k = 0; k < count; k++)
+    {
+        if (dict.words[k]->func == func)
+            return dict.words[k];
+    }
+    return NULL;
+}
+
+/**
+ * Allocate a user-defined word with no code yet
+ * @param name The word's name
+ * @return The new word (not yet added to the dictionary), or NULL if out of memory
+ */
+Word *word_new(const char *name)
+{
+    Word *word = malloc(sizeof(Word));
+    if (!word)
+        return NULL;
+    strcpy(word->name, name);
+    word->func = NULL;
+    word->code = NULL;
+    word->code_size = 0;
+    word->immediate = 0;
+    word->frame_size = 0;
+    word->rcode = NULL;
+    word->rcode_size = 0;
+    word->reg_count = 0;
+    word->backend = BACKEND_DEFAULT;
+    word->pure = 0;
+    word->calls = 0;
+    word->code_field = CODE_COLON;
+    word->param = 0;
+    word->does = NULL;
+    word->memo = NULL;
+    word->spawns = 0;
+    word->next = NULL;
+    return word;
+}
+
+/**
+ * Check whether a word is a constant, variable or CREATEd word without DOES>
+ * Such words only push their param, so references to them can be compiled as literals
+ * @param word The word
+ * @return 1 if it is a data word, 0 otherwise
+ */
+int is_data_word(const Word *word)
+{
+    return !word->func && (word->code_field == CODE_CREATE || word->code_field == CODE_CONSTANT ||
+                           word->code_field == CODE_VARIABLE);
+}
+
+// Code space - Word bodies are allocated contiguously, laid out from a profile when one is loaded
+//
+// With --pgo-profile every user-defined word counts its executions and its calls to other
+// words; the counts are written out when the interpreter exits. With --pgo-use the profile is
+// read before any source: executed words are chained so that the heaviest caller/callee pairs
+// are adjacent, the chains are ordered hottest first, and each word gets a reserved slot at the
+// start of the code space. When the source is loaded again, words land in their slots and
+// everything else (cold or new words) is allocated after the hot region.
+
+Cell code_space[CODE_SPACE_SIZE];      // Contiguous storage for compiled word bodies
+int code_space_top = 0;                // Next free cell after the reserved hot region
+int pgo_profiling = 0;                 // 1 = count calls for --pgo-profile
+PgoEdge pgo_edges[PGO_MAX_EDGES];      // Caller/callee counts (open addressing)
+PgoSlot pgo_slots[DICT_SIZE];          // Reserved placements from --pgo-use
+int pgo_slot_count = 0;                // Number of entries in pgo_slots
+PgoEdge pgo_load_edges[PGO_MAX_EDGES]; // Profile edges by slot index while computing the layout
+
+/**
+ * Allocate storage for a word body
+ * @param name Name of the word (used to find its reserved slot)
+ * @param size Number of cells
+ * @return Pointer to the storage (malloc is used once the code space is full)
+ */
+Cell *code_alloc(const char *name, int size)
+{
+    for (int k = 0; k < pgo_slot_count; k++)
+    {
+        PgoSlot *slot = &pgo_slots[k];
+        if (slot->offset >= 0 && !slot->used && size <= slot->size && strcmp(slot->name, name) == 0)
+        {
+            slot->used = 1;
+            return &code_space[slot->offset];
+        }
+    }
+    if (code_space_top + size > CODE_SPACE_SIZE)
+        return malloc((size ? size : 1) * sizeof(Cell));
+    Cell *code = &code_space[code_space_top];
+    code_space_top += size;
+    return code;
+}
+
+/**
+ * Count one call from a user-defined word to another word
+ * Parallel loop and SPAWN threads count too: an entry is claimed by setting its caller with a
+ * compare-and-swap, then its callee is published; counts are added atomically
+ */
+void pgo_count_edge(Word *caller, Word *callee)
+{
+    if (callee->func)
+        return;
+    unsigned long long h = ((unsigned long long)(size_t)caller * 31 + (size_t)callee) >> 4;
+    for (int probe = 0; probe < PGO_MAX_EDGES; probe++)
+    {
+        PgoEdge *edge = &pgo_edges[(h + probe) & (PGO_MAX_EDGES - 1)];
+        Word *owner = __atomic_load_n(&edge->caller, __ATOMIC_ACQUIRE);
+        if (!owner)
+        {
+            if (__atomic_compare_exchange_n(&edge->caller, &owner, caller, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                __atomic_store_n(&edge->callee, callee, __ATOMIC_RELEASE);
+                __atomic_fetch_add(&edge->count, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            // Another thread claimed the entry first; owner is now its caller
+        }
+        if (owner != caller)
+            continue;
+        Word *claimed;
+        while (!(claimed = __atomic_load_n(&edge->callee, __ATOMIC_ACQUIRE)))
+            ; // The claiming thread is about to publish its callee
+        if (claimed == callee)
+        {
+            __atomic_fetch_add(&edge->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+/**
+ * Write the collected profile
+ * Format: "word <name> <calls> <cells>" per user-defined word, "edge <caller> <callee> <count>"
+ * @param path Output file
+ * @return 1 on success, 0 if the file cannot be written
+ */
+int pgo_save(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 0;
+    fprintf(f, "# Forth execution profile\n");
+    for (int k = 0; k < dict.count; k++)
+    {
+        Word *w = dict.words[k];
+        if (!w->func)
+            fprintf(f, "word %s %ld %d\n", w->name, w->calls, w->code_size);
+    }
+    for (int k = 0; k < PGO_MAX_EDGES; k++)
+    {
+        PgoEdge *edge = &pgo_edges[k];
+        if (edge->caller)
+            fprintf(f, "edge %s %s %ld\n", edge->caller->name, edge->callee->name, edge->count);
+    }
+    return fclose(f) == 0;
+}
+
+/**
+ * Find a profile slot by word name
+ * @return Slot index, or -1 if the word is not in the profile
+ */
+int pgo_find_slot(const char *name)
+{
+    for (int k = 0; k < pgo_slot_count; k++)
+    {
+        if (strcmp(pgo_slots[k].name, name) == 0)
+            return k;
+    }
+    return -1;
+}
+
+/**
+ * Order edges by decreasing call count (qsort callback)
+ */
+int pgo_edge_compare(const void *a, const void *b)
+{
+    long ca = ((const PgoEdge *)a)->count;
+    long cb = ((const PgoEdge *)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/**
+ * Read a profile and reserve the hot region of the code space
+ * Edge words are stored as slot indices (cast to Word *) while the layout is computed
+ * @param path Profile written by --pgo-profile
+ * @return 1 on success, 0 if the file cannot be read
+ */
+int pgo_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    PgoEdge *edges = pgo_load_edges;
+    int edge_count = 0;
+    char line[MAX_LINE_LEN];
+    char a[MAX_WORD_LEN], b[MAX_WORD_LEN];
+    long count;
+    int size;
+
+    pgo_slot_count = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "word %31s %ld %d", a, &count, &size) == 3 && pgo_slot_count < DICT_SIZE && size >= 0)
+        {
+            PgoSlot *slot = &pgo_slots[pgo_slot_count];
+            strcpy(slot->name, a);
+            slot->calls = count;
+            slot->size = size;
+            slot->offset = -1;
+            slot->next = -1;
+            slot->head = pgo_slot_count;
+            slot->used = 0;
+            pgo_slot_count++;
+        }
+        else if (sscanf(line, "edge %31s %31s %ld", a, b, &count) == 3 && edge_count < PGO_MAX_EDGES)
+        {
+            int from = pgo_find_slot(a), to = pgo_find_slot(b);
+            if (from >= 0 && to >= 0 && from != to)
+            {
+                edges[edge_count].caller = (Word *)(size_t)from;
+                edges[edge_count].callee = (Word *)(size_t)to;
+                edges[edge_count].count = count;
+                edge_count++;
+            }
+        }
+    }
+    fclose(f);
+
+    // Join chains along the heaviest edges: caller's chain tail followed by callee's chain head
+    qsort(edges, edge_count, sizeof(PgoEdge), pgo_edge_compare);
+    for (int k = 0; k < edge_count; k++)
+    {
+        int from = (int)(size_t)edges[k].caller, to = (int)(size_t)edges[k].callee;
+        if (pgo_slots[from].calls == 0 || pgo_slots[to].calls == 0 || pgo_slots[from].next >= 0 ||
+            pgo_slots[to].head != to || pgo_slots[from].head == to)
+            continue;
+        pgo_slots[from].next = to;
+        for (int s = to; s >= 0; s = pgo_slots[s].next)
+            pgo_slots[s].head = pgo_slots[from].head;
+    }
+
+    // Place chains hottest first; never executed words stay cold
+    code_space_top = 0;
+    for (;;)
+    {
+        int best = -1;
+        long best_calls = 0;
+        for (int k = 0; k < pgo_slot_count; k++)
+        {
+            PgoSlot *slot = &pgo_slots[k];
+            if (slot->offset < 0 && slot->calls > best_calls && code_space_top + slot->size <= CODE_SPACE_SIZE)
+            {
+                best = slot->head;
+                best_calls = slot->calls;
+            }
+        }
+        if (best < 0)
+            break;
+        for (int s = best; s >= 0; s = pgo_slots[s].next)
+        {
+            if (pgo_slots[s].offset < 0 && code_space_top + pgo_slots[s].size <= CODE_SPACE_SIZE)
+            {
+                pgo_slots[s].offset = code_space_top;
+                code_space_top += pgo_slots[s].size;
+            }
+        }
+    }
+    return 1;
 }
 
 // Basic error handling - Non-fatal error recovery mechanism
@@ -257,10 +799,21 @@ void dict_add(Word *word)
 void error(const char *msg)
 {
     fprintf(stderr, "Error: %s\n", msg);
+    error_count++;
     // Reset stacks and state to continue execution
     data_stack.sp = -1;        // Clear data stack
     return_stack.sp = -1;      // Clear return stack
+    frame_stack.sp = -1;       // Clear call frames
+    // The rest belongs to the interpreter's thread: a pool worker leaves it alone, and the
+    // thread that joins the worker reports the failure
+    if (pool_id != 0)
+        return;
     branch_stack.top = -1;     // Clear branch stack
+    case_sp = -1;              // Clear cases being compiled
+    does_definer = NULL;       // Drop a defining word whose DOES> part was being compiled
+    local_count = 0;           // Forget the locals of the definition
+    local_base = 0;
+    quote_sp = -1;             // Drop quotations being compiled
     state = 0;                 // Back to interpret mode
     code_sp = 0;               // Reset code buffer pointer
     current_word = NULL;       // Clear current word being compiled
@@ -400,92 +953,443 @@ void mod(void)
     stack_push(a % b);
 }
 
-// Built-in stack operations - Functions for manipulating stack contents
+// Single-cell arithmetic - Rewrite the top of the stack in place
 
 /**
- * DUP: (a -- a a)
- * Duplicate the top stack item
+ * 1+ : (a -- a+1)
  */
-void dup(void)
+void one_plus(void)
 {
-    Cell top = stack_peek();
-    stack_push(top);
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp]++;
 }
 
 /**
- * DROP: (a -- )
- * Remove the top stack item
+ * 1- : (a -- a-1)
  */
-void drop(void)
+void one_minus(void)
 {
-    stack_pop();
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp]--;
 }
 
 /**
- * SWAP: (a b -- b a)
- * Exchange the top two stack items
+ * 2* : (a -- a*2)
  */
-void swap(void)
+void two_star(void)
 {
-    Cell b = stack_pop();
-    Cell a = stack_pop();
-    stack_push(b);
-    stack_push(a);
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp] = (Cell)((unsigned long long)data_stack.stack[data_stack.sp] << 1);
 }
 
 /**
- * OVER: (a b -- a b a)
- * Copy the second item to the top
+ * 2/ : (a -- a/2)
+ * Arithmetic shift right, so odd negative numbers round toward negative infinity
  */
-void over(void)
+void two_slash(void)
 {
-    Cell b = stack_pop();
-    Cell a = stack_pop();
-    stack_push(a);
-    stack_push(b);
-    stack_push(a);
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp] >>= 1;
 }
 
 /**
- * ROT: (a b c -- b c a)
- * Rotate the top three items
+ * NEGATE: (a -- -a)
  */
-void rot(void)
+void negate(void)
 {
-    Cell c = stack_pop();
-    Cell b = stack_pop();
-    Cell a = stack_pop();
-    stack_push(b);
-    stack_push(c);
-    stack_push(a);
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp] = (Cell)(0ULL - (unsigned long long)data_stack.stack[data_stack.sp]);
 }
 
 /**
- * NIP: (a b -- b)
- * Remove the second item from the stack
+ * ABS: (a -- |a|)
  */
-void nip(void)
+void abs_op(void)
 {
-    Cell b = stack_pop();
-    stack_pop(); // discard a
-    stack_push(b);
+    if (stack_check(1, 1) && data_stack.stack[data_stack.sp] < 0)
+        negate();
 }
 
 /**
- * TUCK: (a b -- b a b)
- * Copy the top item below the second item
+ * MIN: (a b -- min)
  */
-void tuck(void)
+void min_op(void)
 {
-    Cell b = stack_pop();
-    Cell a = stack_pop();
-    stack_push(b);
-    stack_push(a);
-    stack_push(b);
+    if (!stack_check(2, 1))
+        return;
+    Cell *s = &data_stack.stack[--data_stack.sp];
+    if (s[1] < s[0])
+        s[0] = s[1];
 }
 
-// Built-in comparison operations - Functions that compare two values and push boolean result
-
+/**
+ * MAX: (a b -- max)
+ */
+void max_op(void)
+{
+    if (!stack_check(2, 1))
+        return;
+    Cell *s = &data_stack.stack[--data_stack.sp];
+    if (s[1] > s[0])
+        s[0] = s[1];
+}
+
+// Strength reduction - Shift and multiply-high forms of multiplication and division by constants
+
+MagicDivisor magic_divisors[MAGIC_MAX]; // Reciprocal multipliers of divisors seen so far
+int magic_count = 0;                    // Number of entries in magic_divisors
+
+/**
+ * Divide by a power of two, rounding toward zero like /
+ * @param n Dividend
+ * @param k Shift count (1..62)
+ * @return n / 2^k
+ */
+Cell div_pow2(Cell n, Cell k)
+{
+    // Negative dividends are biased by 2^k - 1 so the arithmetic shift truncates toward zero
+    Cell bias = (n >> 63) & (((Cell)1 << k) - 1);
+    return (n + bias) >> k;
+}
+
+/**
+ * Remainder of division by a power of two, with the sign of the dividend like mod
+ * @param n Dividend
+ * @param k Shift count (1..62)
+ * @return n mod 2^k
+ */
+Cell mod_pow2(Cell n, Cell k)
+{
+    return n - (Cell)((unsigned long long)div_pow2(n, k) << k);
+}
+
+/**
+ * Divide by a constant with a multiply-high and shifts (Granlund-Montgomery)
+ * @param n Dividend
+ * @param m Reciprocal of the divisor
+ * @return n / divisor, rounding toward zero
+ */
+Cell div_magic(Cell n, const MagicDivisor *m)
+{
+    Cell q = (Cell)(((__int128)n * m->multiplier) >> 64);
+    if (m->divisor > 0 && m->multiplier < 0)
+        q += n;
+    if (m->divisor < 0 && m->multiplier > 0)
+        q -= n;
+    q >>= m->shift;
+    return q + (Cell)((unsigned long long)q >> 63);
+}
+
+/**
+ * Find or compute the reciprocal multiplier of a divisor
+ * @param d Divisor (|d| >= 2, not a power of two)
+ * @return Index into magic_divisors, or -1 if the table is full
+ */
+int magic_lookup(Cell d)
+{
+    for (int k = 0; k < magic_count; k++)
+    {
+        if (magic_divisors[k].divisor == d)
+            return k;
+    }
+    if (magic_count >= MAGIC_MAX)
+        return -1;
+
+    // Hacker's Delight, figure 10-1, widened to 64 bits
+    const unsigned long long two63 = 1ULL << 63;
+    unsigned long long ad = d < 0 ? -(unsigned long long)d : (unsigned long long)d;
+    unsigned long long t = two63 + ((unsigned long long)d >> 63);
+    unsigned long long anc = t - 1 - t % ad;
+    unsigned long long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long long delta;
+    int p = 63;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    MagicDivisor *m = &magic_divisors[magic_count];
+    m->divisor = d;
+    m->multiplier = (Cell)(q2 + 1);
+    if (d < 0)
+        m->multiplier = -m->multiplier;
+    m->shift = p - 64;
+    return magic_count++;
+}
+
+/**
+ * Choose a cheaper form for *, / or mod by a constant right operand
+ * @param func star, slash or mod
+ * @param c The constant operand
+ * @param arg Out: shift count or magic_divisors index
+ * @return OP_SHL, OP_DIVP2, OP_MODP2, OP_DIVK or OP_MODK, or 0 to keep the generic word
+ */
+Cell strength_reduce(void (*func)(), Cell c, Cell *arg)
+{
+    if (func != star && func != slash && func != mod)
+        return 0;
+
+    // Powers of two from 2 to 2^62
+    if (c > 1 && (c & (c - 1)) == 0)
+    {
+        Cell k = 0;
+        while (((Cell)1 << k) != c)
+            k++;
+        *arg = k;
+        return func == star ? OP_SHL : func == slash ? OP_DIVP2 : OP_MODP2;
+    }
+
+    // Other divisors except 0, 1, -1 and the most negative cell, which have no multiplier
+    if (func == star || c == 0 || c == 1 || c == -1 || c == LLONG_MIN)
+        return 0;
+    int index = magic_lookup(c);
+    if (index < 0)
+        return 0;
+    *arg = index;
+    return func == slash ? OP_DIVK : OP_MODK;
+}
+
+/**
+ * Apply a strength-reduced operation
+ * @param op OP_SHL, OP_DIVP2, OP_MODP2, OP_DIVK or OP_MODK
+ * @param n The left operand
+ * @param arg Shift count or magic_divisors index
+ * @return The same result the generic *, / or mod gives
+ */
+Cell apply_reduced(Cell op, Cell n, Cell arg)
+{
+    const MagicDivisor *m = &magic_divisors[op == OP_DIVK || op == OP_MODK ? arg : 0];
+    switch (op)
+    {
+    case OP_SHL: return (Cell)((unsigned long long)n << arg);
+    case OP_DIVP2: return div_pow2(n, arg);
+    case OP_MODP2: return mod_pow2(n, arg);
+    case OP_DIVK: return div_magic(n, m);
+    default: return n - div_magic(n, m) * m->divisor;
+    }
+}
+
+// Built-in stack operations - Functions for manipulating stack contents
+
+/**
+ * DUP: (a -- a a)
+ * Duplicate the top stack item
+ */
+void dup_op(void)
+{
+    Cell top = stack_peek();
+    stack_push(top);
+}
+
+/**
+ * DROP: (a -- )
+ * Remove the top stack item
+ */
+void drop(void)
+{
+    stack_pop();
+}
+
+/**
+ * SWAP: (a b -- b a)
+ * Exchange the top two stack items
+ */
+void swap(void)
+{
+    Cell b = stack_pop();
+    Cell a = stack_pop();
+    stack_push(b);
+    stack_push(a);
+}
+
+/**
+ * OVER: (a b -- a b a)
+ * Copy the second item to the top
+ */
+void over(void)
+{
+    Cell b = stack_pop();
+    Cell a = stack_pop();
+    stack_push(a);
+    stack_push(b);
+    stack_push(a);
+}
+
+/**
+ * ROT: (a b c -- b c a)
+ * Rotate the top three items
+ */
+void rot(void)
+{
+    Cell c = stack_pop();
+    Cell b = stack_pop();
+    Cell a = stack_pop();
+    stack_push(b);
+    stack_push(c);
+    stack_push(a);
+}
+
+/**
+ * NIP: (a b -- b)
+ * Remove the second item from the stack
+ */
+void nip(void)
+{
+    Cell b = stack_pop();
+    stack_pop(); // discard a
+    stack_push(b);
+}
+
+/**
+ * TUCK: (a b -- b a b)
+ * Copy the top item below the second item
+ */
+void tuck(void)
+{
+    Cell b = stack_pop();
+    Cell a = stack_pop();
+    stack_push(b);
+    stack_push(a);
+    stack_push(b);
+}
+
+/**
+ * 2DUP: (a b -- a b a b)
+ */
+void two_dup(void)
+{
+    if (!stack_check(2, 4))
+        return;
+    Cell *s = &data_stack.stack[data_stack.sp];
+    s[1] = s[-1];
+    s[2] = s[0];
+    data_stack.sp += 2;
+}
+
+/**
+ * 2DROP: (a b -- )
+ */
+void two_drop(void)
+{
+    if (stack_check(2, 0))
+        data_stack.sp -= 2;
+}
+
+/**
+ * 2SWAP: (a b c d -- c d a b)
+ */
+void two_swap(void)
+{
+    if (!stack_check(4, 4))
+        return;
+    Cell *s = &data_stack.stack[data_stack.sp - 3];
+    Cell a = s[0], b = s[1];
+    s[0] = s[2];
+    s[1] = s[3];
+    s[2] = a;
+    s[3] = b;
+}
+
+/**
+ * 2OVER: (a b c d -- a b c d a b)
+ */
+void two_over(void)
+{
+    if (!stack_check(4, 6))
+        return;
+    Cell *s = &data_stack.stack[data_stack.sp];
+    s[1] = s[-3];
+    s[2] = s[-2];
+    data_stack.sp += 2;
+}
+
+/**
+ * -ROT: (a b c -- c a b)
+ * Rotate the top three items the other way
+ */
+void minus_rot(void)
+{
+    if (!stack_check(3, 3))
+        return;
+    Cell *s = &data_stack.stack[data_stack.sp - 2];
+    Cell c = s[2];
+    s[2] = s[1];
+    s[1] = s[0];
+    s[0] = c;
+}
+
+/**
+ * ?DUP: (a -- a a | 0)
+ * Duplicate the top item unless it is zero
+ */
+void question_dup(void)
+{
+    if (!stack_check(1, 1))
+        return;
+    if (data_stack.stack[data_stack.sp] != 0)
+        dup_op();
+}
+
+/**
+ * PICK: (xu ... x0 u -- xu ... x0 xu)
+ * Copy the u-th item below u to the top
+ */
+void pick_word(void)
+{
+    if (!stack_check(1, 1))
+        return;
+    Cell u = data_stack.stack[data_stack.sp--];
+    stack_pick(u);
+}
+
+/**
+ * ROLL: (xu xu-1 ... x0 u -- xu-1 ... x0 xu)
+ * Move the u-th item below u to the top
+ */
+void roll_word(void)
+{
+    if (!stack_check(1, 1))
+        return;
+    Cell u = data_stack.stack[data_stack.sp];
+    if (u < 0 || u >= data_stack.sp)
+    {
+        error("Stack underflow");
+        return;
+    }
+    data_stack.sp--;
+    Cell *s = &data_stack.stack[data_stack.sp - u];
+    Cell x = s[0];
+    memmove(s, s + 1, u * sizeof(Cell));
+    s[u] = x;
+}
+
+/**
+ * DEPTH: ( -- n)
+ * Push the number of items on the stack before DEPTH ran
+ */
+void depth_word(void)
+{
+    stack_push(data_stack.sp + 1);
+}
+
+// Built-in comparison operations - Functions that compare two values and push boolean result
+
 /**
  * = : (a b -- flag)
  * Push -1 if a equals b, 0 otherwise
@@ -552,6 +1456,16 @@ void not_equal(void)
     stack_push(a != b ? -1 : 0);
 }
 
+/**
+ * 0= : (a -- flag)
+ * Push -1 if a is zero, 0 otherwise
+ */
+void zero_equal(void)
+{
+    if (stack_check(1, 1))
+        data_stack.stack[data_stack.sp] = data_stack.stack[data_stack.sp] == 0 ? -1 : 0;
+}
+
 // Built-in logical operations - Bitwise logical operations
 
 /**
@@ -586,6 +1500,44 @@ void not_op(void)
     stack_push(~a);
 }
 
+/**
+ * XOR: (a b -- a^b)
+ * Push bitwise exclusive OR of a and b
+ */
+void xor_op(void)
+{
+    if (!stack_check(2, 1))
+        return;
+    data_stack.sp--;
+    data_stack.stack[data_stack.sp] ^= data_stack.stack[data_stack.sp + 1];
+}
+
+/**
+ * LSHIFT: (a u -- a<<u)
+ * Shifts by 64 or more bits leave 0
+ */
+void lshift(void)
+{
+    if (!stack_check(2, 1))
+        return;
+    unsigned long long u = (unsigned long long)data_stack.stack[data_stack.sp--];
+    Cell *s = &data_stack.stack[data_stack.sp];
+    *s = u >= 64 ? 0 : (Cell)((unsigned long long)*s << u);
+}
+
+/**
+ * RSHIFT: (a u -- a>>u)
+ * Logical shift, filling with zero bits; shifts by 64 or more bits leave 0
+ */
+void rshift(void)
+{
+    if (!stack_check(2, 1))
+        return;
+    unsigned long long u = (unsigned long long)data_stack.stack[data_stack.sp--];
+    Cell *s = &data_stack.stack[data_stack.sp];
+    *s = u >= 64 ? 0 : (Cell)((unsigned long long)*s >> u);
+}
+
 // Built-in memory operations - Functions for storing and fetching from memory
 
 /**
@@ -610,6 +1562,80 @@ void fetch(void)
     stack_push(value);
 }
 
+// Atomic memory operations - Cells shared between threads (parallel loops, SPAWN children)
+//
+// @ and ! are plain accesses that the compiler may tear, cache or reorder. These words use
+// the GCC __atomic builtins (the C11 memory model, without needing C11) on memory[] cells;
+// all of them are sequentially consistent.
+
+/**
+ * Check an address for an atomic access
+ * @param addr The memory address
+ * @return The cell, or NULL after reporting an error
+ */
+Cell *atomic_cell(Cell addr)
+{
+    if (addr < 0 || addr >= STACK_SIZE)
+    {
+        error("Invalid memory address");
+        return NULL;
+    }
+    return &memory[addr];
+}
+
+/**
+ * ATOMIC@: Fetch a cell other threads may be storing to ( addr -- x )
+ */
+void atomic_fetch_word(void)
+{
+    Cell *cell = atomic_cell(stack_pop());
+    if (cell)
+        stack_push(__atomic_load_n(cell, __ATOMIC_SEQ_CST));
+}
+
+/**
+ * ATOMIC!: Store a cell other threads may be reading ( x addr -- )
+ */
+void atomic_store_word(void)
+{
+    Cell *cell = atomic_cell(stack_pop());
+    Cell x = stack_pop();
+    if (cell)
+        __atomic_store_n(cell, x, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * ATOMIC+!: Add n to a cell as one indivisible update ( n addr -- )
+ */
+void atomic_add_word(void)
+{
+    Cell *cell = atomic_cell(stack_pop());
+    Cell n = stack_pop();
+    if (cell)
+        __atomic_fetch_add(cell, n, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * CAS: Store new at addr if it still holds expected ( expected new addr -- flag )
+ * flag is true if the store happened
+ */
+void cas_word(void)
+{
+    Cell *cell = atomic_cell(stack_pop());
+    Cell desired = stack_pop();
+    Cell expected = stack_pop();
+    if (cell)
+        stack_push(__atomic_compare_exchange_n(cell, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? -1 : 0);
+}
+
+/**
+ * FENCE: Order the memory accesses before it before those after it, for every thread ( -- )
+ */
+void fence_word(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
 // Built-in CREATE word - Creates a word that pushes a memory address onto the stack
 
 /**
@@ -625,18 +1651,217 @@ void create_word(void)
         return;
     }
     int addr = next_mem_addr;  // Get current memory address (don't increment)
-    Word *new_word = malloc(sizeof(Word));
-    strcpy(new_word->name, name);
-    new_word->func = NULL;
-    new_word->code = malloc(2 * sizeof(Cell));
+    Word *new_word = word_new(name);
+    new_word->code = code_alloc(name, 3); // Room for a DOES> behaviour call
     new_word->code[0] = OP_LIT;     // Literal opcode
     new_word->code[1] = addr;       // The memory address
     new_word->code_size = 2;
-    new_word->next = NULL;
+    new_word->pure = 1;
+    new_word->code_field = CODE_CREATE;
+    new_word->param = addr;
     dict_add(new_word);
 }
 
-// Built-in VARIABLE word - Creates a named variable that pushes its address
+/**
+ * DOES>: End the defining part of a colon definition; the rest of the definition becomes
+ * the behaviour shared by every word the defining word creates
+ * At run time the defining word binds the behaviour to the word it has just CREATEd
+ */
+void does_word(void)
+{
+    if (state == 0 || !current_word || does_definer || quote_sp >= 0)
+    {
+        error("DOES> outside a defining word");
+        return;
+    }
+    if (branch_stack.top >= 0 || case_sp >= 0)
+    {
+        error("DOES> inside a control structure");
+        return;
+    }
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+
+    Word *behaviour = word_new("(does>)");
+    code_buffer[code_sp++] = OP_DOES;
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = (Cell)behaviour;
+
+    // The defining word is complete; it is added to the dictionary at ;
+    finish_definition(current_word);
+    does_definer = current_word;
+    current_word = behaviour;
+    code_sp = 0;
+    local_count = 0; // Locals of the defining part are not visible after DOES>
+}
+
+/**
+ * DEFER: Create a word whose action is set later with IS
+ * Calls to it go through its param cell, so changing the action needs no recompilation
+ */
+void defer_word(void)
+{
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error("DEFER needs a name");
+        return;
+    }
+    Word *new_word = word_new(name);
+    new_word->code_field = CODE_DEFER;
+    new_word->param = 0; // No action yet
+    dict_add(new_word);
+}
+
+/**
+ * Point a deferred word at an execution token
+ * @param defer The deferred word
+ * @param xt The new action
+ * @return 1 on success, 0 after reporting an error
+ */
+int defer_set(Word *defer, Cell xt)
+{
+    if (defer->func || defer->code_field != CODE_DEFER)
+    {
+        error("Not a deferred word");
+        return 0;
+    }
+    Word *w = xt_word(xt);
+    if (!w)
+        return 0;
+    // Following the new action must not lead back to this word
+    while (!w->func && w->code_field == CODE_DEFER && w != defer && w->param)
+        w = (Word *)w->param;
+    if (w == defer)
+    {
+        error("Deferred word would run itself");
+        return 0;
+    }
+    defer->param = xt;
+    return 1;
+}
+
+/**
+ * Read the name of a deferred word from the input
+ * @param missing Error message when there is no name
+ * @return The word, or NULL after reporting an error
+ */
+Word *defer_name(const char *missing)
+{
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error(missing);
+        return NULL;
+    }
+    Word *w = dict_find(name);
+    if (!w || w->func || w->code_field != CODE_DEFER)
+    {
+        error("Not a deferred word");
+        return NULL;
+    }
+    return w;
+}
+
+/**
+ * Compile "deferred-xt word" for IS and ACTION-OF inside a definition
+ * @param defer The deferred word
+ * @param func defer_store_word or defer_fetch_word
+ */
+void defer_compile(Word *defer, void (*func)())
+{
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = (Cell)defer;
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(func);
+}
+
+/**
+ * IS: Set the action of the next deferred word ( xt -- )
+ * In a definition the assignment is compiled and happens when the definition runs
+ */
+void is_word(void)
+{
+    Word *w = defer_name("IS needs a name");
+    if (!w)
+        return;
+    if (state)
+        defer_compile(w, defer_store_word);
+    else
+        defer_set(w, stack_pop());
+}
+
+/**
+ * ACTION-OF: Push the action of the next deferred word ( -- xt )
+ * In a definition the action is fetched when the definition runs
+ */
+void action_of_word(void)
+{
+    Word *w = defer_name("ACTION-OF needs a name");
+    if (!w)
+        return;
+    if (state)
+        defer_compile(w, defer_fetch_word);
+    else
+        stack_push(w->param);
+}
+
+/**
+ * DEFER@: Action of a deferred word ( xt-defer -- xt )
+ */
+void defer_fetch_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    if (!w)
+        return;
+    if (w->func || w->code_field != CODE_DEFER)
+    {
+        error("Not a deferred word");
+        return;
+    }
+    stack_push(w->param);
+}
+
+/**
+ * DEFER!: Set the action of a deferred word ( xt xt-defer -- )
+ */
+void defer_store_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    Cell xt = stack_pop();
+    if (w)
+        defer_set(w, xt);
+}
+
+/**
+ * Give the most recently CREATEd word a DOES> behaviour
+ * Its code becomes "address behaviour" so the optimizer and partial evaluator see what it does,
+ * while execute_word runs it through the CODE_DOES code field
+ * @param behaviour The behaviour word compiled after DOES>
+ */
+void does_bind(Word *behaviour)
+{
+    Word *w = dict.count > 0 ? dict.words[dict.count - 1] : NULL;
+    if (!w || w->func || (w->code_field != CODE_CREATE && w->code_field != CODE_DOES))
+    {
+        error("DOES> without CREATE");
+        return;
+    }
+    w->code_field = CODE_DOES;
+    w->does = behaviour;
+    w->code[2] = (Cell)behaviour;
+    w->code_size = 3;
+    w->pure = behaviour->pure;
+}
+
+// Built-in VARIABLE word - Creates a named variable that pushes its address
 
 /**
  * VARIABLE: Parse next token as name and create a variable at the next memory location
@@ -651,14 +1876,14 @@ void variable_word(void)
         return;
     }
     int addr = next_mem_addr++;  // Allocate new memory location
-    Word *new_word = malloc(sizeof(Word));
-    strcpy(new_word->name, name);
-    new_word->func = NULL;
-    new_word->code = malloc(2 * sizeof(Cell));
+    Word *new_word = word_new(name);
+    new_word->code = code_alloc(name, 2);
     new_word->code[0] = OP_LIT;     // Literal opcode
     new_word->code[1] = addr;       // The variable's memory address
     new_word->code_size = 2;
-    new_word->next = NULL;
+    new_word->pure = 1;
+    new_word->code_field = CODE_VARIABLE;
+    new_word->param = addr;
     dict_add(new_word);
 }
 
@@ -677,14 +1902,14 @@ void constant_word(void)
         return;
     }
     Cell value = stack_pop();  // Get the constant value from stack
-    Word *new_word = malloc(sizeof(Word));
-    strcpy(new_word->name, name);
-    new_word->func = NULL;
-    new_word->code = malloc(2 * sizeof(Cell));
+    Word *new_word = word_new(name);
+    new_word->code = code_alloc(name, 2);
     new_word->code[0] = OP_LIT;     // Literal opcode
     new_word->code[1] = value;      // The constant value
     new_word->code_size = 2;
-    new_word->next = NULL;
+    new_word->pure = 1;
+    new_word->code_field = CODE_CONSTANT;
+    new_word->param = value;
     dict_add(new_word);
 }
 
@@ -697,6 +1922,21 @@ void constant_word(void)
  */
 void execute_word(Word *word)
 {
+    // Nothing runs while a word stopped by STEP-LIMIT unwinds
+    if (step_aborted)
+        return;
+
+    // Deferred words run their current action in this call
+    while (!word->func && word->code_field == CODE_DEFER)
+    {
+        if (!word->param)
+        {
+            error("Deferred word has no action");
+            return;
+        }
+        word = (Word *)word->param;
+    }
+
     // If it's a built-in word, call its function directly
     if (word->func)
     {
@@ -704,6 +1944,66 @@ void execute_word(Word *word)
         return;
     }
 
+    if (pgo_profiling)
+        __atomic_fetch_add(&word->calls, 1, __ATOMIC_RELAXED); // Also counted on pool threads
+
+    // Code fields: constants, variables and CREATEd words only push their param, DOES> words
+    // then run the shared behaviour in this call instead of entering their own code array
+    if (word->code_field != CODE_COLON)
+    {
+        stack_push(word->param);
+        if (word->code_field != CODE_DOES)
+            return;
+        word = word->does;
+    }
+
+    // Words that SPAWN wait for their children before they return
+    if (word->spawns)
+    {
+        spawn_scope(word);
+        return;
+    }
+
+    // MEMO: words answer from their cache when they can (caches are not shared between threads)
+    if (word->memo && !parallel_active)
+    {
+        memo_execute(word);
+        return;
+    }
+
+    execute_code(word);
+}
+
+/**
+ * Run the code of a user-defined word on its backend
+ * @param word A colon definition, DOES> behaviour or quotation
+ */
+void execute_code(Word *word)
+{
+    // Entering a definition counts against the step budget, like a backward branch
+    if (--step_budget <= 0 && !step_expired())
+        return;
+
+    // Use the register VM translation when that backend is selected for this word
+    int backend = word->backend == BACKEND_DEFAULT ? vm_backend : word->backend;
+    if (backend == BACKEND_REGISTER && word->rcode)
+    {
+        execute_registers(word);
+        return;
+    }
+
+    // Allocate the frame slots used by optimized code for this call
+    int frame_base = frame_stack.sp + 1;
+    if (word->frame_size > 0)
+    {
+        if (frame_base + word->frame_size > STACK_SIZE)
+        {
+            error("Frame stack overflow");
+            return;
+        }
+        frame_stack.sp += word->frame_size;
+    }
+
     // Execute threaded code for user-defined words
     // Each item in code[] is either an opcode, literal value, or word pointer
     for (int i = 0; i < word->code_size; i++)
@@ -722,6 +2022,8 @@ void execute_word(Word *word)
             i++; // Skip OP_LIT marker
             i++; // Skip to the offset value
             Cell offset = word->code[i];
+            if (offset <= 0 && --step_budget <= 0 && !step_expired())
+                break; // Backward branches count against the step budget
             i += offset - 1; // Jump to target (-1 because loop will increment)
         }
         // Handle conditional branch (OP_0BRANCH offset)
@@ -733,6 +2035,8 @@ void execute_word(Word *word)
             Cell top = stack_pop(); // Pop condition flag
             if (top == 0) // If false (0), take the branch
             {
+                if (offset <= 0 && --step_budget <= 0 && !step_expired())
+                    break;
                 i += offset - 1; // Jump to target
             }
         }
@@ -754,6 +2058,8 @@ void execute_word(Word *word)
             if (index < limit) // Continue looping?
             {
                 rstack_push(index); // Push updated index back
+                if (--step_budget <= 0 && !step_expired())
+                    break;
                 // Branch back to loop start
                 i++; // Skip OP_LIT marker
                 i++; // Skip to the offset value
@@ -763,9 +2069,99 @@ void execute_word(Word *word)
             else
             {
                 rstack_pop(); // Remove limit from return stack
+                i += 2;       // Skip the offset operand
                 // Loop ends, continue to next instruction
             }
         }
+        // Handle LOOP with a constant step (OP_LOOPK offset step), produced by loop unrolling
+        else if (item == OP_LOOPK)
+        {
+            Cell index = rstack_pop() + word->code[i + 4];
+            if (index < rstack_peek())
+            {
+                rstack_push(index);
+                if (--step_budget <= 0 && !step_expired())
+                    break;
+                i += 2;                  // Skip to the offset value
+                i += word->code[i] - 1;  // Jump back
+            }
+            else
+            {
+                rstack_pop();
+                i += 4; // Skip the offset and step operands
+            }
+        }
+        // Handle case dispatch (OP_JTAB/OP_BSEARCH default base count): go to the selector's entry
+        else if (item == OP_JTAB || item == OP_BSEARCH)
+        {
+            Cell entry = case_dispatch(item, stack_peek(), word->code[i + 4], word->code[i + 6]);
+            if (entry < 0)
+            {
+                i += 2;                  // Skip to the default offset
+                i += word->code[i] - 1;  // Jump to the default code
+            }
+            else
+            {
+                i += 7 + 3 * entry - 1;  // Continue at the entry's branch
+            }
+        }
+        // Handle POSTPONE (OP_COMPILE word): append the word to the definition being compiled
+        else if (item == OP_COMPILE)
+        {
+            i += 2;
+            if (!current_word)
+            {
+                error("POSTPONEd word used outside of compilation mode");
+                break;
+            }
+            if (!compile_word((Word *)word->code[i]))
+                break;
+        }
+        // Handle fused MAP, REDUCE and FOR-EACH (OP_MAP .. OP_FOR_EACH quotation)
+        else if (item <= OP_MAP && item >= OP_FOR_EACH)
+        {
+            i += 2;
+            range_apply(item, (Word *)word->code[i]);
+        }
+        // Handle DOES> (OP_DOES behaviour): bind the behaviour to the word just CREATEd
+        else if (item == OP_DOES)
+        {
+            i += 2;
+            does_bind((Word *)word->code[i]);
+        }
+        // Handle stack pick (OP_PICK n): copy the n-th item below the top
+        else if (item == OP_PICK)
+        {
+            i++; // Skip OP_LIT marker
+            i++; // Skip to the depth value
+            stack_pick(word->code[i]);
+        }
+        // Handle stack slide (OP_SLIDE r n): remove r items below the top n
+        else if (item == OP_SLIDE)
+        {
+            i += 2;
+            Cell r = word->code[i];
+            i += 2;
+            stack_slide(r, word->code[i]);
+        }
+        // Handle frame slot read (OP_RGET slot)
+        else if (item == OP_RGET)
+        {
+            i += 2;
+            stack_push(frame_stack.stack[frame_base + word->code[i]]);
+        }
+        // Handle frame slot write (OP_RSET slot)
+        else if (item == OP_RSET)
+        {
+            i += 2;
+            frame_stack.stack[frame_base + word->code[i]] = stack_pop();
+        }
+        // Handle strength-reduced *, / and mod by a constant (OP_SHL .. OP_MODK arg)
+        else if (item <= OP_SHL && item >= OP_MODK)
+        {
+            i += 2;
+            stack_push(apply_reduced(item, stack_pop(), word->code[i]));
+        }
         else
         {
             // Check if item is a word pointer (large address values)
@@ -776,7 +2172,11 @@ void execute_word(Word *word)
                 // Basic validation of word pointer
                 if (w && w->name && w->name[0] != '\0')
                 {
+                    if (pgo_profiling)
+                        pgo_count_edge(word, w);
                     execute_word(w); // Recursively execute the referenced word
+                    if (step_aborted)
+                        break;
                 }
                 else
                 {
@@ -790,6 +2190,183 @@ void execute_word(Word *word)
             }
         }
     }
+
+    // Release this call's frame slots
+    frame_stack.sp = frame_base - 1;
+}
+
+/**
+ * Execute a word's register VM translation
+ * Registers live in the call's frame, above the frame slots used by the stack code
+ * @param word The word to execute (must have rcode)
+ */
+void execute_registers(Word *word)
+{
+    int frame_base = frame_stack.sp + 1;
+    int frame_cells = word->frame_size + word->reg_count;
+    if (frame_base + frame_cells > STACK_SIZE)
+    {
+        error("Frame stack overflow");
+        return;
+    }
+    frame_stack.sp += frame_cells;
+    Cell *frame = &frame_stack.stack[frame_base];
+    Cell *R = frame + word->frame_size;
+
+    for (int pc = 0; pc < word->rcode_size; pc++)
+    {
+        const RegInsn *ins = &word->rcode[pc];
+        switch (ins->op)
+        {
+        case RV_LOADK: R[ins->a] = ins->k; break;
+        case RV_GETS:
+            if (ins->k > data_stack.sp)
+            {
+                error("Stack underflow");
+                R[ins->a] = 0;
+            }
+            else
+            {
+                R[ins->a] = data_stack.stack[data_stack.sp - ins->k];
+            }
+            break;
+        case RV_GETF: R[ins->a] = frame[ins->k]; break;
+        case RV_SETF: frame[ins->k] = stack_pop(); break;
+        case RV_PUSH: stack_push(R[ins->a]); break;
+        case RV_PUSHK: stack_push(ins->k); break;
+        case RV_DROP: stack_slide(ins->k, 0); break;
+
+        case RV_ADD: R[ins->a] = R[ins->b] + R[ins->c]; break;
+        case RV_SUB: R[ins->a] = R[ins->b] - R[ins->c]; break;
+        case RV_MUL: R[ins->a] = R[ins->b] * R[ins->c]; break;
+        case RV_DIV:
+        case RV_MOD:
+            if (R[ins->c] == 0)
+            {
+                error(ins->op == RV_DIV ? "Division by zero" : "Modulo by zero");
+                R[ins->a] = 0;
+            }
+            else
+            {
+                R[ins->a] = ins->op == RV_DIV ? R[ins->b] / R[ins->c] : R[ins->b] % R[ins->c];
+            }
+            break;
+        case RV_EQ: R[ins->a] = R[ins->b] == R[ins->c] ? -1 : 0; break;
+        case RV_LT: R[ins->a] = R[ins->b] < R[ins->c] ? -1 : 0; break;
+        case RV_GT: R[ins->a] = R[ins->b] > R[ins->c] ? -1 : 0; break;
+        case RV_LE: R[ins->a] = R[ins->b] <= R[ins->c] ? -1 : 0; break;
+        case RV_GE: R[ins->a] = R[ins->b] >= R[ins->c] ? -1 : 0; break;
+        case RV_NE: R[ins->a] = R[ins->b] != R[ins->c] ? -1 : 0; break;
+        case RV_AND: R[ins->a] = R[ins->b] & R[ins->c]; break;
+        case RV_OR: R[ins->a] = R[ins->b] | R[ins->c]; break;
+
+        // Constant forms are only generated for non-zero divisors
+        case RV_ADDK: R[ins->a] = R[ins->b] + ins->k; break;
+        case RV_SUBK: R[ins->a] = R[ins->b] - ins->k; break;
+        case RV_MULK: R[ins->a] = R[ins->b] * ins->k; break;
+        case RV_DIVK: R[ins->a] = R[ins->b] / ins->k; break;
+        case RV_MODK: R[ins->a] = R[ins->b] % ins->k; break;
+        case RV_EQK: R[ins->a] = R[ins->b] == ins->k ? -1 : 0; break;
+        case RV_LTK: R[ins->a] = R[ins->b] < ins->k ? -1 : 0; break;
+        case RV_GTK: R[ins->a] = R[ins->b] > ins->k ? -1 : 0; break;
+        case RV_LEK: R[ins->a] = R[ins->b] <= ins->k ? -1 : 0; break;
+        case RV_GEK: R[ins->a] = R[ins->b] >= ins->k ? -1 : 0; break;
+        case RV_NEK: R[ins->a] = R[ins->b] != ins->k ? -1 : 0; break;
+        case RV_ANDK: R[ins->a] = R[ins->b] & ins->k; break;
+        case RV_ORK: R[ins->a] = R[ins->b] | ins->k; break;
+        case RV_SHLK: R[ins->a] = (Cell)((unsigned long long)R[ins->b] << ins->k); break;
+        case RV_DIVP2: R[ins->a] = div_pow2(R[ins->b], ins->k); break;
+        case RV_MODP2: R[ins->a] = mod_pow2(R[ins->b], ins->k); break;
+        case RV_DIVM: R[ins->a] = div_magic(R[ins->b], &magic_divisors[ins->k]); break;
+        case RV_MODM:
+            R[ins->a] = R[ins->b] - div_magic(R[ins->b], &magic_divisors[ins->k]) * magic_divisors[ins->k].divisor;
+            break;
+
+        case RV_NOT: R[ins->a] = ~R[ins->b]; break;
+        case RV_I: R[ins->a] = rstack_peek(); break;
+        case RV_J: R[ins->a] = rstack_peek_n(2); break;
+        case RV_APPLY:
+            // Pure built-in without a dedicated opcode: run it on the data stack
+            if (ins->b >= 0)
+                stack_push(R[ins->b]);
+            if (ins->c >= 0)
+                stack_push(R[ins->c]);
+            ((Word *)ins->k)->func();
+            R[ins->a] = stack_pop();
+            break;
+        case RV_CALL:
+            if (pgo_profiling)
+                pgo_count_edge(word, (Word *)ins->k);
+            execute_word((Word *)ins->k);
+            if (step_aborted)
+                pc = word->rcode_size;
+            break;
+        case RV_RANGE: range_apply(ins->a, (Word *)ins->k); break;
+        case RV_PICK: stack_pick(ins->k); break;
+        case RV_SLIDE: stack_slide(ins->b, ins->c); break;
+
+        // Backward jumps count against the step budget
+        case RV_JMP:
+            if (ins->k <= pc && --step_budget <= 0 && !step_expired())
+                pc = word->rcode_size;
+            else
+                pc = (int)ins->k - 1;
+            break;
+        case RV_JMPZ:
+            if (R[ins->a] == 0)
+            {
+                if (ins->k <= pc && --step_budget <= 0 && !step_expired())
+                    pc = word->rcode_size;
+                else
+                    pc = (int)ins->k - 1;
+            }
+            break;
+        case RV_JMPZS:
+            if (stack_pop() == 0)
+            {
+                if (ins->k <= pc && --step_budget <= 0 && !step_expired())
+                    pc = word->rcode_size;
+                else
+                    pc = (int)ins->k - 1;
+            }
+            break;
+        case RV_SWITCH:
+        {
+            Cell entry = case_dispatch(ins->b ? OP_BSEARCH : OP_JTAB, stack_peek(), ins->k, ins->a);
+            if (entry >= 0)
+                pc += 1 + (int)entry; // Skip the default jump
+            break;
+        }
+        case RV_DO:
+        {
+            Cell start = stack_pop();
+            Cell limit = stack_pop();
+            rstack_push(limit);
+            rstack_push(start);
+            break;
+        }
+        case RV_LOOP:
+        {
+            Cell index = rstack_pop() + ins->b;
+            if (index < rstack_peek())
+            {
+                rstack_push(index);
+                if (--step_budget <= 0 && !step_expired())
+                    pc = word->rcode_size;
+                else
+                    pc = (int)ins->k - 1;
+            }
+            else
+            {
+                rstack_pop();
+            }
+            break;
+        }
+        }
+    }
+
+    // Release this call's frame slots and registers
+    frame_stack.sp = frame_base - 1;
 }
 
 // Built-in I/O operations
@@ -825,6 +2402,16 @@ void allot_word(void)
     next_mem_addr += n;
 }
 
+/**
+ * ,: Store a cell at the next free memory address and allocate it
+ */
+void comma_word(void)
+{
+    Cell value = stack_pop();
+    mem_store(next_mem_addr, value);
+    next_mem_addr++;
+}
+
 void i_word(void)
 {
     stack_push(rstack_peek());
@@ -835,6 +2422,39 @@ void j_word(void)
     stack_push(rstack_peek_n(2));
 }
 
+/**
+ * >R: (a -- ) (R: -- a)
+ * Move the top item to the return stack; inside a DO loop it must be taken back before I, J or LOOP
+ */
+void to_r(void)
+{
+    if (stack_check(1, 0))
+        rstack_push(data_stack.stack[data_stack.sp--]);
+}
+
+/**
+ * R>: ( -- a) (R: a -- )
+ * Move the top of the return stack to the data stack
+ */
+void r_from(void)
+{
+    if (return_stack.sp < 0)
+    {
+        error("Return stack underflow");
+        return;
+    }
+    stack_push(return_stack.stack[return_stack.sp--]);
+}
+
+/**
+ * R@: ( -- a) (R: a -- a)
+ * Copy the top of the return stack to the data stack
+ */
+void r_fetch(void)
+{
+    stack_push(rstack_peek());
+}
+
 // Control flow functions - Words for implementing conditional and looping constructs
 
 /**
@@ -916,7 +2536,7 @@ void else_word(void)
         code_buffer[code_sp++] = 0;         // Placeholder for offset
 
         // Fix the IF branch to jump to start of ELSE
-        Cell if_offset = (code_sp + 3) - (entry.origin + 2);
+        Cell if_offset = code_sp - (entry.origin + 2);
         code_buffer[entry.origin + 2] = if_offset;
 
         // Replace IF entry with ELSE entry on branch stack
@@ -940,255 +2560,5229 @@ void end_word(void)
     // For now, we'll leave it as a placeholder
 }
 
-void colon(void)
+void colon(void)
+{
+    char word_name[MAX_WORD_LEN];
+
+    // Read the next token as the word name
+    if (!tokenize(word_name))
+    {
+        error("Expected word name after :\"");
+        return;
+    }
+
+    // Check if word already exists
+    if (dict_find(word_name))
+    {
+        error("Word already exists");
+        return;
+    }
+
+    // Create new word; its code is allocated from the code space at ;
+    Word *new_word = word_new(word_name);
+    if (!new_word)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+
+    // Set current word and switch to compile mode
+    current_word = new_word;
+    state = 1;
+    code_sp = 0; // Reset code buffer pointer
+    local_count = 0;
+}
+
+void semicolon(void)
+{
+    if (state == 0)
+    {
+        error("Misplaced ;");
+        return;
+    }
+
+    if (!current_word)
+    {
+        error("No word being defined");
+        return;
+    }
+
+    if (quote_sp >= 0)
+    {
+        error(quote_stack[quote_sp].kind == QUOTE_PDO ? "Missing PLOOP" : "Missing ;]");
+        return;
+    }
+
+    finish_definition(current_word);
+    if (current_word->memo && !current_word->pure)
+    {
+        error("MEMO: definition is not pure");
+        return;
+    }
+
+    // Add to dictionary; after DOES> the word being finished is the defining word's behaviour
+    if (does_definer)
+    {
+        dict_add(does_definer);
+        does_definer = NULL;
+    }
+    else
+    {
+        dict_add(current_word);
+    }
+
+    // Reset state
+    state = 0;
+    current_word = NULL;
+    code_sp = 0;
+    case_sp = -1;
+    local_count = 0;
+}
+
+/**
+ * Optimize the code in code_buffer and install it as a word's code
+ * @param word The word being defined
+ */
+void finish_definition(Word *word)
+{
+    // Evaluate pure calls on literal arguments, inline literal quotations, unroll constant
+    // loops, then run the optimizer
+    code_sp = partial_eval(code_buffer, code_sp);
+    code_sp = fuse_quotations(code_buffer, code_sp);
+    code_sp = unroll_loops(code_buffer, code_sp);
+    code_sp = partial_eval(code_buffer, code_sp);
+    code_sp = optimize_code(code_buffer, code_sp, &word->frame_size);
+    code_sp = reduce_code(code_buffer, code_sp);
+
+    // Copy compiled code from buffer to word
+    word->code = code_alloc(word->name, code_sp);
+    word->code_size = code_sp;
+    memcpy(word->code, code_buffer, code_sp * sizeof(Cell));
+
+    // Generate the register VM translation from the optimized code
+    compile_registers(word);
+
+    // Recursive calls (RECURSE) are pure when the rest of the code is
+    word->pure = 1;
+    word->pure = code_is_pure(word->code, word->code_size);
+    word->spawns = code_calls(word->code, word->code_size, spawn_word);
+}
+
+/**
+ * Append a reference to a word to the definition being compiled
+ * Constants, variables and CREATEd words are compiled as their value
+ * @param word The word to compile
+ * @return 1 on success, 0 if the code buffer is full (an error has been reported)
+ */
+int compile_word(Word *word)
+{
+    int data = is_data_word(word);
+    if (code_sp + (data ? 2 : 1) > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return 0;
+    }
+    if (data)
+    {
+        code_buffer[code_sp++] = OP_LIT;
+        code_buffer[code_sp++] = word->param;
+    }
+    else
+    {
+        code_buffer[code_sp++] = (Cell)word;
+    }
+    return 1;
+}
+
+// Compile-time words - Switch between interpreting and compiling inside a definition
+
+/**
+ * [: Interpret the following words while a definition is being compiled
+ */
+void left_bracket_word(void)
+{
+    if (!state || !current_word)
+    {
+        error("[ used outside of compilation mode");
+        return;
+    }
+    state = 0;
+}
+
+/**
+ * ]: Resume compiling the current definition
+ */
+void right_bracket_word(void)
+{
+    if (!current_word)
+    {
+        error("] used outside of a definition");
+        return;
+    }
+    state = 1;
+}
+
+/**
+ * LITERAL: Compile the top of the stack as a literal ( n -- )
+ */
+void literal_word(void)
+{
+    if (!state || !current_word)
+    {
+        error("LITERAL used outside of compilation mode");
+        return;
+    }
+    if (code_sp + 2 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+    Cell value = stack_pop();
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = value;
+}
+
+/**
+ * POSTPONE: Defer the compilation behaviour of the next word
+ * An immediate word is compiled as a call, so it runs when the current word runs; any other
+ * word is compiled as OP_COMPILE, which appends it to the definition being compiled then
+ */
+void postpone_word(void)
+{
+    char name[MAX_WORD_LEN];
+    if (!state || !current_word)
+    {
+        error("POSTPONE used outside of compilation mode");
+        return;
+    }
+    if (!tokenize(name))
+    {
+        error("POSTPONE needs a name");
+        return;
+    }
+    Word *word = dict_find(name);
+    if (!word)
+    {
+        error("Unknown word after POSTPONE");
+        return;
+    }
+    if (word->immediate)
+    {
+        compile_word(word);
+        return;
+    }
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+    code_buffer[code_sp++] = OP_COMPILE;
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = (Cell)word;
+}
+
+/**
+ * IMMEDIATE: Make the most recently defined word run while compiling
+ */
+void immediate_word(void)
+{
+    if (dict.count == 0 || state)
+    {
+        error("IMMEDIATE needs a finished definition");
+        return;
+    }
+    dict.words[dict.count - 1]->immediate = 1;
+}
+
+/**
+ * RECURSE: Compile a call to the definition being compiled
+ * Its name is not in the dictionary until ; so it cannot be called by name
+ */
+void recurse_word(void)
+{
+    if (!state || !current_word)
+    {
+        error("RECURSE used outside of compilation mode");
+        return;
+    }
+    if (!compile_word(current_word))
+        error("Code buffer overflow");
+}
+
+// Locals - Named frame slots of the definition being compiled
+//
+// {: a b | c -- comment :} declares a and b, initialized from the stack (b from the top),
+// and c, initialized to nothing in particular. A local's slot is its declaration index;
+// the word's frame_size covers them and the optimizer places its own slots after them.
+// Reads compile to OP_RGET and TO name compiles to OP_RSET, one dispatch per access.
+
+char local_names[LOCALS_MAX][MAX_WORD_LEN]; // Names of the declared locals, by slot
+int local_count = 0;                        // Number of declared locals
+int local_base = 0;                         // First local of the innermost definition (quotations)
+
+/**
+ * Find a local of the definition being compiled
+ * @param name The local's name
+ * @return Its frame slot, or -1 if no local has that name
+ */
+int local_find(const char *name)
+{
+    for (int k = local_count - 1; k >= local_base; k--)
+    {
+        if (strcmp(local_names[k], name) == 0)
+            return k - local_base;
+    }
+    return -1;
+}
+
+/**
+ * Append a frame slot access to the definition being compiled
+ * @param op OP_RGET or OP_RSET
+ * @param slot The local's frame slot
+ * @return 1 on success, 0 if the code buffer is full (an error has been reported)
+ */
+int compile_local(Cell op, int slot)
+{
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return 0;
+    }
+    code_buffer[code_sp++] = op;
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = slot;
+    return 1;
+}
+
+/**
+ * {: Declare locals up to :} and compile the stores of the initialized ones
+ */
+void locals_word(void)
+{
+    char name[MAX_WORD_LEN];
+    int first = local_count;
+    int initialized = -1; // Locals before | are taken from the stack
+    int comment = 0;
+
+    if (!state || !current_word)
+    {
+        error("{: used outside of compilation mode");
+        return;
+    }
+    for (;;)
+    {
+        if (!tokenize(name))
+        {
+            error("Missing :}");
+            return;
+        }
+        if (strcmp(name, ":}") == 0)
+            break;
+        if (comment)
+            continue;
+        if (strcmp(name, "--") == 0)
+        {
+            comment = 1;
+        }
+        else if (strcmp(name, "|") == 0 && initialized < 0)
+        {
+            initialized = local_count;
+        }
+        else if (local_count >= LOCALS_MAX)
+        {
+            error("Too many locals");
+            return;
+        }
+        else
+        {
+            strcpy(local_names[local_count++], name);
+        }
+    }
+    if (initialized < 0)
+        initialized = local_count;
+    if (local_count - local_base > current_word->frame_size)
+        current_word->frame_size = local_count - local_base;
+
+    // The last initialized local is the top of the stack
+    for (int slot = initialized - 1; slot >= first; slot--)
+    {
+        if (!compile_local(OP_RSET, slot - local_base))
+            return;
+    }
+}
+
+/**
+ * TO: Compile a store of the top of the stack into the next local ( x -- )
+ */
+void to_word(void)
+{
+    char name[MAX_WORD_LEN];
+    if (!state || !current_word)
+    {
+        error("TO used outside of compilation mode");
+        return;
+    }
+    if (!tokenize(name))
+    {
+        error("TO needs a name");
+        return;
+    }
+    int slot = local_find(name);
+    if (slot < 0)
+    {
+        error("TO needs a local");
+        return;
+    }
+    compile_local(OP_RSET, slot);
+}
+
+// Quotations - [: ... ;] compiles an anonymous word and leaves its execution token
+//
+// The body is compiled at the end of code_buffer like the rest of the definition; ;] moves
+// it out, finishes it as a word of its own and compiles "OP_LIT xt" in its place. Locals of
+// the enclosing definition are not visible inside, since the quotation has its own frame.
+
+QuoteFrame quote_stack[QUOTE_MAX_NEST]; // Enclosing definitions of the quotations being compiled
+int quote_sp = -1;                      // Top of quote_stack
+Cell quote_save[STACK_SIZE];            // Enclosing code while a quotation body is finished
+Word *quotations = NULL;                // Compiled quotations, linked through next
+
+/**
+ * Start an anonymous definition inside the current one
+ * @param kind QUOTE_PLAIN for [:, QUOTE_PDO for the body of a PDO loop
+ */
+void quotation_begin(int kind)
+{
+    if (quote_sp + 1 >= QUOTE_MAX_NEST)
+    {
+        error("Quotations nested too deeply");
+        return;
+    }
+    Word *quot = word_new("(quotation)");
+    if (!quot)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    QuoteFrame *frame = &quote_stack[++quote_sp];
+    frame->kind = kind;
+    frame->outer = current_word;
+    frame->start = code_sp;
+    frame->branch_top = branch_stack.top;
+    frame->case_sp = case_sp;
+    frame->local_base = local_base;
+    local_base = local_count;
+    current_word = quot;
+}
+
+/**
+ * [: Start an anonymous definition inside the current one
+ */
+void quotation_word(void)
+{
+    if (!state || !current_word)
+    {
+        error("[: used outside of compilation mode");
+        return;
+    }
+    quotation_begin(QUOTE_PLAIN);
+}
+
+/**
+ * Finish the innermost quotation and compile its execution token
+ * @param kind What started it (QUOTE_PLAIN or QUOTE_PDO)
+ * @return 1 on success, 0 after reporting an error
+ */
+int quotation_end(int kind)
+{
+    if (!state || quote_sp < 0 || quote_stack[quote_sp].kind != kind)
+    {
+        error(kind == QUOTE_PDO ? "PLOOP without PDO" : ";] without [:");
+        return 0;
+    }
+    QuoteFrame *frame = &quote_stack[quote_sp];
+    if (branch_stack.top != frame->branch_top || case_sp != frame->case_sp)
+    {
+        error("Unbalanced control structure in quotation");
+        return 0;
+    }
+
+    // Finish the body as a word of its own, then put the enclosing code back
+    Word *quot = current_word;
+    int size = code_sp - frame->start;
+    memcpy(quote_save, code_buffer, frame->start * sizeof(Cell));
+    memmove(code_buffer, code_buffer + frame->start, size * sizeof(Cell));
+    code_sp = size;
+    finish_definition(quot);
+    memcpy(code_buffer, quote_save, frame->start * sizeof(Cell));
+    code_sp = frame->start;
+    quot->next = quotations;
+    quotations = quot;
+    xt_add(quot);
+
+    current_word = frame->outer;
+    local_count = local_base;
+    local_base = frame->local_base;
+    quote_sp--;
+
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = (Cell)quot;
+    return 1;
+}
+
+/**
+ * ;] Finish the innermost quotation and compile its execution token ( -- xt )
+ */
+void end_quotation_word(void)
+{
+    quotation_end(QUOTE_PLAIN);
+}
+
+/**
+ * ': Push the execution token of the next word ( -- xt )
+ */
+void tick_word(void)
+{
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error("' needs a name");
+        return;
+    }
+    Word *word = dict_find(name);
+    if (!word)
+    {
+        error("Unknown word after '");
+        return;
+    }
+    stack_push((Cell)word);
+}
+
+/**
+ * Check that a cell is an execution token
+ * @param xt The cell
+ * @return The word it refers to, or NULL after reporting an error
+ */
+Word *xt_word(Cell xt)
+{
+    // Only words in the dictionary and compiled quotations are execution tokens
+    Word *w = is_word_pointer(xt) ? xt_find(xt) : NULL;
+    if (!w)
+        error("Invalid execution token");
+    return w;
+}
+
+/**
+ * EXECUTE: Run an execution token ( i*x xt -- j*x )
+ */
+void execute_xt_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    if (w)
+        execute_word(w);
+}
+
+/**
+ * Check that n cells starting at addr lie in memory
+ * @return 1 if they do (or n <= 0), 0 after reporting an error
+ */
+int range_valid(Cell addr, Cell n)
+{
+    if (n > 0 && (addr < 0 || addr > STACK_SIZE || n > STACK_SIZE - addr))
+    {
+        error("Invalid memory range");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Check that a buffer of n bytes, packed eight to a cell from addr, lies in memory
+ * @return 1 if it does (or n <= 0), 0 after reporting an error
+ */
+int byte_range_valid(Cell addr, Cell n)
+{
+    if (n > 0 && (addr < 0 || addr > STACK_SIZE || n > (STACK_SIZE - addr) * (Cell)sizeof(Cell)))
+    {
+        error("Invalid memory range");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Apply a word over a memory range; the loop behind MAP, REDUCE, FOR-EACH and their fused opcodes
+ * @param op OP_MAP ( addr n -- ), OP_REDUCE ( addr n init -- result ) or OP_FOR_EACH ( addr n -- )
+ * @param w The word applied to each cell
+ */
+void range_apply(Cell op, Word *w)
+{
+    Cell init = op == OP_REDUCE ? stack_pop() : 0;
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (!range_valid(addr, n))
+        return;
+    if (op == OP_REDUCE)
+        stack_push(init);
+    long errors = error_count;
+    for (Cell k = 0; k < n; k++)
+    {
+        stack_push(memory[addr + k]);
+        execute_word(w);
+        if (error_count != errors)
+            return; // Stop at the first failure, before anything is stored
+        if (op == OP_MAP)
+            memory[addr + k] = stack_pop();
+    }
+}
+
+/**
+ * MAP: Replace each of n cells starting at addr by xt applied to it ( addr n xt -- )
+ * xt has the effect ( x -- y )
+ */
+void map_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    if (w)
+        range_apply(OP_MAP, w);
+}
+
+/**
+ * REDUCE: Fold n cells starting at addr into init with xt ( addr n init xt -- result )
+ * xt has the effect ( acc x -- acc' )
+ */
+void reduce_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    if (w)
+        range_apply(OP_REDUCE, w);
+}
+
+/**
+ * FOR-EACH: Apply xt to each of n cells starting at addr ( addr n xt -- )
+ * xt has the effect ( x -- )
+ */
+void for_each_word(void)
+{
+    Word *w = xt_word(stack_pop());
+    if (w)
+        range_apply(OP_FOR_EACH, w);
+}
+
+// Memoization - MEMO: definitions answer repeated inputs from a per-word result cache
+//
+// "in out MEMO: name ... ;" compiles like a colon definition that must be pure and take
+// exactly in cells to out cells. Its cache is an open-addressing table keyed on the input
+// cells: a key lives within MEMO_PROBE slots of its hash, so lookups and inserts are bounded,
+// and a full window either drops its least recently used entry or leaves the result uncached.
+
+/**
+ * Allocate an empty cache
+ * @param in Input cells per key
+ * @param out Result cells per entry
+ * @param capacity Requested entries, rounded up to a power of two
+ * @return The cache, or NULL when out of memory
+ */
+MemoTable *memo_new(int in, int out, int capacity)
+{
+    int size = 1;
+    while (size < capacity)
+        size <<= 1;
+    MemoTable *memo = malloc(sizeof(MemoTable));
+    if (!memo)
+        return NULL;
+    memo->entries = calloc((size_t)size * (1 + in + out), sizeof(Cell));
+    if (!memo->entries)
+    {
+        free(memo);
+        return NULL;
+    }
+    memo->in = in;
+    memo->out = out;
+    memo->capacity = size;
+    memo->evict = MEMO_EVICT_LRU;
+    memo->clock = 0;
+    memo->hits = memo->misses = memo->evictions = 0;
+    return memo;
+}
+
+/**
+ * Hash the input cells of a key (FNV-1a over whole cells, high bits folded down)
+ * @param key The input cells
+ * @param n Number of cells
+ * @return The hash
+ */
+unsigned long long memo_hash(const Cell *key, int n)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (int k = 0; k < n; k++)
+    {
+        h ^= (unsigned long long)key[k];
+        h *= 1099511628211ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+/**
+ * Find the cached entry for a key
+ * Entries are never removed, only replaced, so an empty slot ends the search
+ * @param memo The cache
+ * @param key The input cells
+ * @return The entry (last use, key, results), or NULL if the key is not cached
+ */
+Cell *memo_find(MemoTable *memo, const Cell *key)
+{
+    int stride = 1 + memo->in + memo->out;
+    int mask = memo->capacity - 1;
+    int slot = (int)(memo_hash(key, memo->in) & mask);
+    for (int p = 0; p < MEMO_PROBE && p < memo->capacity; p++)
+    {
+        Cell *entry = memo->entries + (size_t)((slot + p) & mask) * stride;
+        if (!entry[0])
+            return NULL;
+        if (memcmp(entry + 1, key, memo->in * sizeof(Cell)) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/**
+ * Cache the results for a key that is not cached yet
+ * @param memo The cache
+ * @param key The input cells
+ * @param results The result cells
+ */
+void memo_insert(MemoTable *memo, const Cell *key, const Cell *results)
+{
+    int stride = 1 + memo->in + memo->out;
+    int mask = memo->capacity - 1;
+    int slot = (int)(memo_hash(key, memo->in) & mask);
+    Cell *victim = NULL;
+    for (int p = 0; p < MEMO_PROBE && p < memo->capacity; p++)
+    {
+        Cell *entry = memo->entries + (size_t)((slot + p) & mask) * stride;
+        if (!entry[0])
+        {
+            victim = entry;
+            break;
+        }
+        if (!victim || entry[0] < victim[0])
+            victim = entry;
+    }
+    if (victim[0])
+    {
+        if (memo->evict == MEMO_EVICT_NONE)
+            return;
+        memo->evictions++;
+    }
+    victim[0] = ++memo->clock;
+    memcpy(victim + 1, key, memo->in * sizeof(Cell));
+    memcpy(victim + 1 + memo->in, results, memo->out * sizeof(Cell));
+}
+
+/**
+ * Run a MEMO: word: push the cached results for its inputs, or run it and cache what it leaves
+ * Results are only cached when the definition left exactly its declared number of cells
+ * @param word The memoized word
+ */
+void memo_execute(Word *word)
+{
+    MemoTable *memo = word->memo;
+    if (data_stack.sp + 1 < memo->in)
+    {
+        error("Stack underflow");
+        return;
+    }
+    int base = data_stack.sp - memo->in + 1;
+    Cell key[MEMO_MAX_ARITY];
+    memcpy(key, &data_stack.stack[base], memo->in * sizeof(Cell));
+
+    Cell *entry = memo_find(memo, key);
+    if (entry)
+    {
+        memo->hits++;
+        entry[0] = ++memo->clock;
+        data_stack.sp = base - 1;
+        for (int k = 0; k < memo->out; k++)
+            stack_push(entry[1 + memo->in + k]);
+        return;
+    }
+
+    memo->misses++;
+    long errors = error_count;
+    execute_code(word);
+    if (error_count != errors || step_aborted)
+        return; // Already reported
+    if (data_stack.sp != base - 1 + memo->out)
+    {
+        error("MEMO: word left the wrong number of cells");
+        return;
+    }
+    memo_insert(memo, key, &data_stack.stack[base]);
+}
+
+/**
+ * Read the name of a MEMO: word from the input
+ * @return The word, or NULL after reporting an error
+ */
+Word *memo_name(void)
+{
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error("Expected a MEMO: word name");
+        return NULL;
+    }
+    Word *w = dict_find(name);
+    if (!w || w->func || !w->memo)
+    {
+        error("Not a MEMO: word");
+        return NULL;
+    }
+    return w;
+}
+
+/**
+ * MEMO: Start a memoized definition ( in out -- )
+ * The definition must be pure; ; reports an error otherwise
+ */
+void memo_colon_word(void)
+{
+    if (data_stack.sp < 1)
+    {
+        error("MEMO: needs input and output counts");
+        return;
+    }
+    Cell out = stack_pop();
+    Cell in = stack_pop();
+    if (in < 0 || in > MEMO_MAX_ARITY || out < 1 || out > MEMO_MAX_ARITY)
+    {
+        error("MEMO: arity out of range");
+        return;
+    }
+    colon();
+    if (!current_word)
+        return;
+    current_word->memo = memo_new((int)in, (int)out, MEMO_DEFAULT_CAPACITY);
+    if (!current_word->memo)
+        error("Memory allocation failed");
+}
+
+/**
+ * MEMO-CAPACITY: Resize a MEMO: word's cache, dropping its entries ( n -- )
+ */
+void memo_capacity_word(void)
+{
+    Cell capacity = stack_pop();
+    Word *w = memo_name();
+    if (!w)
+        return;
+    if (capacity < 1 || capacity > MEMO_MAX_CAPACITY)
+    {
+        error("MEMO-CAPACITY out of range");
+        return;
+    }
+    MemoTable *memo = memo_new(w->memo->in, w->memo->out, (int)capacity);
+    if (!memo)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    memo->evict = w->memo->evict;
+    free(w->memo->entries);
+    free(w->memo);
+    w->memo = memo;
+}
+
+/**
+ * MEMO-EVICT: Choose what a full probe window does ( policy -- )
+ * 0 keeps the cached entries, 1 replaces the least recently used one
+ */
+void memo_evict_word(void)
+{
+    Cell policy = stack_pop();
+    Word *w = memo_name();
+    if (!w)
+        return;
+    if (policy != MEMO_EVICT_NONE && policy != MEMO_EVICT_LRU)
+    {
+        error("Unknown MEMO-EVICT policy");
+        return;
+    }
+    w->memo->evict = (int)policy;
+}
+
+/**
+ * MEMO-STATS: Counters of a MEMO: word's cache ( -- hits misses evictions )
+ */
+void memo_stats_word(void)
+{
+    Word *w = memo_name();
+    if (!w)
+        return;
+    stack_push(w->memo->hits);
+    stack_push(w->memo->misses);
+    stack_push(w->memo->evictions);
+}
+
+/**
+ * MEMO-CLEAR: Empty a MEMO: word's cache and reset its counters
+ */
+void memo_clear_word(void)
+{
+    Word *w = memo_name();
+    if (!w)
+        return;
+    MemoTable *memo = w->memo;
+    memset(memo->entries, 0, (size_t)memo->capacity * (1 + memo->in + memo->out) * sizeof(Cell));
+    memo->clock = 0;
+    memo->hits = memo->misses = memo->evictions = 0;
+}
+
+// Multitasking - Cooperative round-robin tasks switched by PAUSE
+//
+// Every task runs on a C stack of its own, so a task can be suspended anywhere: in the
+// middle of a definition, inside a DO loop, in a word called through EXECUTE or MAP. The
+// interpreter's data, return and frame stacks stay global; a switch copies the live cells
+// of the outgoing context out of them and the incoming context's back in, then swaps C
+// contexts. Task 0 is the operator, the REPL itself, which is always active.
+//
+// Coroutines use the same machinery but are not scheduled: RESUME runs one on behalf of
+// the current task until it YIELDs a value or returns. The context a task is running
+// (itself, or the innermost coroutine it resumed) is its top; PAUSE saves and resumes tops,
+// so a coroutine can pause too.
+
+Task operator_task = {.active = 1, .top = &operator_task}; // State of the REPL while another task runs
+Task *tasks[TASK_MAX] = {&operator_task};
+int task_count = 1;              // Tasks and coroutines created so far, including the operator
+int task_current = 0;            // Task running now
+
+/**
+ * Copy the live cells of a stack
+ * @param to Destination
+ * @param from Source
+ */
+void stack_copy(Stack *to, const Stack *from)
+{
+    to->sp = from->sp;
+    memcpy(to->stack, from->stack, (from->sp + 1) * sizeof(Cell));
+}
+
+/**
+ * Look up a task or coroutine by number
+ * @param id Number pushed by a TASK or COROUTINE word
+ * @param coroutine 1 to look up a coroutine, 0 for a task
+ * @return The task, or NULL after reporting an error
+ */
+Task *task_get(Cell id, int coroutine)
+{
+    if (id <= 0 || id >= task_count || tasks[id]->coroutine != coroutine)
+    {
+        error(coroutine ? "Invalid coroutine" : "Invalid task");
+        return NULL;
+    }
+    return tasks[id];
+}
+
+/**
+ * Find the task that gets the next turn
+ * @return The next active task after the current one, the current one if there is none
+ */
+int task_next(void)
+{
+    for (int k = 1; k <= task_count; k++)
+    {
+        int id = (task_current + k) % task_count;
+        if (tasks[id]->active && !tasks[id]->coroutine && !tasks[id]->parked)
+            return id;
+    }
+    return task_current;
+}
+
+/**
+ * Save one context's stacks, load another's and continue where that one left off
+ * Returns when some context switches back to from
+ * @param from The running context
+ * @param to Context to resume
+ */
+void context_switch(Task *from, Task *to)
+{
+    from->steps_left -= step_grant - step_budget;
+    stack_copy(&from->data, &data_stack);
+    stack_copy(&from->ret, &return_stack);
+    stack_copy(&from->frame, &frame_stack);
+    stack_copy(&data_stack, &to->data);
+    stack_copy(&return_stack, &to->ret);
+    stack_copy(&frame_stack, &to->frame);
+    swapcontext(&from->context, &to->context);
+    step_refill(); // A new turn for from
+}
+
+/**
+ * Suspend the current task and resume another
+ * @param to Task to resume
+ */
+void task_switch(int to)
+{
+    Task *from = tasks[task_current]->top;
+    task_current = to;
+    context_switch(from, tasks[to]->top);
+}
+
+/**
+ * Set up a task or coroutine to run a word from the start with empty stacks
+ * @return 1 on success, 0 after reporting an error
+ */
+int task_start(Task *task, Word *xt)
+{
+    if (!task->c_stack && !(task->c_stack = malloc(TASK_C_STACK)))
+    {
+        error("Memory allocation failed");
+        return 0;
+    }
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->c_stack;
+    task->context.uc_stack.ss_size = TASK_C_STACK;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, task_entry, 0);
+    task->data.sp = task->ret.sp = task->frame.sp = -1;
+    task->xt = xt;
+    task->active = 1;
+    task->steps_left = step_limit;
+    return 1;
+}
+
+/**
+ * Abandon the coroutines a task is running, so START can reuse them
+ */
+void task_unwind(Task *task)
+{
+    for (Task *co = task->top; co != task;)
+    {
+        Task *caller = co->caller;
+        co->caller = NULL;
+        co->active = 0;
+        co = caller;
+    }
+    task->top = task;
+}
+
+/**
+ * Run the word of the context that was just switched to, then end it
+ */
+void task_entry(void)
+{
+    Task *self = tasks[task_current]->top;
+    step_refill();
+    execute_word(self->xt);
+    step_aborted = 0; // A word stopped by STEP-LIMIT ends its task or coroutine
+    if (self->coroutine)
+        coroutine_return(self, 0);
+    stop_word();
+}
+
+/**
+ * Create a task or coroutine and a word that pushes its number
+ * @param coroutine 1 for COROUTINE, 0 for TASK
+ */
+void task_create(int coroutine)
+{
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error(coroutine ? "COROUTINE needs a name" : "TASK needs a name");
+        return;
+    }
+    if (task_count >= TASK_MAX)
+    {
+        error("Too many tasks");
+        return;
+    }
+    Task *task = calloc(1, sizeof(Task));
+    if (!task)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    task->data.sp = task->ret.sp = task->frame.sp = -1;
+    task->top = task;
+    task->coroutine = coroutine;
+    tasks[task_count] = task;
+
+    Word *new_word = word_new(name);
+    new_word->code = code_alloc(name, 2);
+    new_word->code[0] = OP_LIT;
+    new_word->code[1] = task_count;
+    new_word->code_size = 2;
+    new_word->pure = 1;
+    new_word->code_field = CODE_CONSTANT;
+    new_word->param = task_count;
+    dict_add(new_word);
+    task_count++;
+}
+
+/**
+ * TASK: Create a task; name pushes its task number
+ */
+void task_word(void)
+{
+    task_create(0);
+}
+
+/**
+ * ACTIVATE: Make a task run xt from the start with empty stacks ( xt task -- )
+ * The task first runs at the next PAUSE; when xt returns the task stops
+ */
+void activate_word(void)
+{
+    Task *task = task_get(stack_pop(), 0);
+    Word *w = xt_word(stack_pop());
+    if (!task || !w)
+        return;
+    if (task == tasks[task_current])
+    {
+        error("A task cannot ACTIVATE itself");
+        return;
+    }
+    if (task->parked)
+        event_wake(task);
+    task_unwind(task);
+    task_start(task, w);
+}
+
+/**
+ * PAUSE: Let the next active task run until it pauses or stops
+ */
+void pause_word(void)
+{
+    if (parallel_active)
+        return; // Parallel loop bodies run to completion
+    if (spawn_sp > 0)
+    {
+        error("PAUSE with unsynced SPAWN children");
+        return;
+    }
+    int next = task_next_ready();
+    if (next != task_current)
+        task_switch(next);
+}
+
+/**
+ * STOP: End the current task and pass control to the next one
+ * The task stays stopped until it is activated again
+ */
+void stop_word(void)
+{
+    if (task_current == 0 || parallel_active)
+    {
+        error("STOP outside a task");
+        return;
+    }
+    Task *task = tasks[task_current];
+    Task *running = task->top;
+    task_unwind(task);
+    task->active = 0;
+    task_current = task_next_ready(); // The operator is always active, so this never returns
+    context_switch(running, tasks[task_current]->top);
+}
+
+/**
+ * Hand control from a coroutine back to the context that resumed it
+ * @param co The running coroutine
+ * @param yielded 1 for YIELD, 0 when its word has returned
+ */
+void coroutine_return(Task *co, int yielded)
+{
+    Task *caller = co->caller;
+    co->caller = NULL;
+    co->active = yielded;
+    tasks[task_current]->top = caller;
+    context_switch(co, caller);
+}
+
+/**
+ * COROUTINE: Create a coroutine; name pushes its number
+ */
+void coroutine_word(void)
+{
+    task_create(1);
+}
+
+/**
+ * START: Make a coroutine run xt from the start on its own stacks ( x1 .. xn n xt co -- )
+ * x1 .. xn become its initial data stack; nothing runs until RESUME
+ */
+void start_word(void)
+{
+    Task *co = task_get(stack_pop(), 1);
+    Word *w = xt_word(stack_pop());
+    Cell n = stack_pop();
+    if (!co || !w)
+        return;
+    if (co->caller)
+    {
+        error("Coroutine is already running");
+        return;
+    }
+    if (n < 0 || n > data_stack.sp + 1)
+    {
+        error("Stack underflow");
+        return;
+    }
+    if (!task_start(co, w))
+        return;
+    data_stack.sp -= n;
+    memcpy(co->data.stack, &data_stack.stack[data_stack.sp + 1], n * sizeof(Cell));
+    co->data.sp = n - 1;
+}
+
+/**
+ * RESUME: Run a coroutine until it yields or returns ( co -- x true | false )
+ * A finished coroutine returns false until it is started again
+ */
+void resume_word(void)
+{
+    Task *co = task_get(stack_pop(), 1);
+    if (!co)
+        return;
+    if (parallel_active)
+    {
+        error("RESUME inside a parallel loop");
+        return;
+    }
+    if (co->caller)
+    {
+        error("Coroutine is already running");
+        return;
+    }
+    if (!co->active)
+    {
+        stack_push(0);
+        return;
+    }
+    Task *self = tasks[task_current]->top;
+    co->caller = self;
+    tasks[task_current]->top = co;
+    context_switch(self, co);
+    if (co->active)
+    {
+        stack_push(co->value);
+        stack_push(-1);
+    }
+    else
+    {
+        stack_push(0);
+    }
+}
+
+/**
+ * YIELD: Pass x to the context that resumed this coroutine and suspend until resumed ( x -- )
+ */
+void yield_word(void)
+{
+    Task *co = tasks[task_current]->top;
+    if (!co->coroutine || parallel_active)
+    {
+        error("YIELD outside a coroutine");
+        return;
+    }
+    co->value = stack_pop();
+    coroutine_return(co, 1);
+}
+
+// Parallel loops - limit start PDO ... PLOOP runs its body on a pool of worker threads
+//
+// The body is compiled as a quotation, and PLOOP compiles "body kind (PDO)". Worker threads
+// are started once, on the first loop that is worth splitting, and sleep on a condition
+// variable in between. Every thread taking part, the calling one included, hands out chunks
+// of the index range from a shared counter, so uneven iterations balance out. Workers run
+// on their own data, return and frame stacks (thread-local), starting from a copy of the
+// caller's data and return stacks so that the body can read values under the loop bounds
+// and J. memory[] is shared. MEMO: caches are bypassed and PAUSE does nothing while a
+// parallel loop runs, since neither is shared between threads.
+
+ParallelPool pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+int parallel_active = 0;         // 1 while the threads of a parallel loop run
+int pdo_threads = 0;             // Threads per parallel loop (0 = one per core available)
+Stack pdo_data;                  // Caller's data stack, copied into each worker
+Stack pdo_ret;                   // Caller's return stack, copied so that J works
+
+/**
+ * Thread function of a pool worker: run each dispatched job, then report back
+ * @param arg Worker number (1 ... pool.size)
+ */
+void *pool_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    long seen = 0;
+    pool_id = id;
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        if (id >= pool.threads)
+            continue; // Not needed for this job
+        pthread_mutex_unlock(&pool.lock);
+        pool.job(pool.arg, id);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+/**
+ * Number of threads a parallel loop may use, starting the workers it needs
+ * Without PDO-THREADS that is one per core the process may run on
+ * @return Threads including the calling one (1 when no worker could be started)
+ */
+int pool_threads(void)
+{
+    int wanted = pdo_threads;
+    if (wanted == 0)
+    {
+        cpu_set_t cores;
+        wanted = sched_getaffinity(0, sizeof(cores), &cores) == 0 ? CPU_COUNT(&cores) : 1;
+    }
+    if (wanted > POOL_MAX_THREADS)
+        wanted = POOL_MAX_THREADS;
+    while (pool.size < wanted - 1)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, (void *)(intptr_t)(pool.size + 1)) != 0)
+            break;
+        pthread_detach(thread);
+        pool.size++;
+    }
+    return wanted < pool.size + 1 ? wanted : pool.size + 1;
+}
+
+/**
+ * Run a job on the calling thread (as thread 0) and threads - 1 workers, and wait for all
+ * @param job Function run by each thread with the job argument and its thread number
+ * @param arg Job argument
+ * @param threads Threads taking part (at most pool.size + 1)
+ */
+void pool_run(void (*job)(void *arg, int id), void *arg, int threads)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.arg = arg;
+    pool.threads = threads;
+    pool.pending = threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    job(arg, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Identity of a PDO reduction, the result of an empty loop
+ */
+Cell pdo_identity(int reduce)
+{
+    return reduce == PDO_REDUCE_MIN ? LLONG_MAX : reduce == PDO_REDUCE_MAX ? LLONG_MIN : 0;
+}
+
+/**
+ * Combine two partial results of a PDO reduction
+ */
+Cell pdo_combine(int reduce, Cell a, Cell b)
+{
+    switch (reduce)
+    {
+    case PDO_REDUCE_SUM: return (Cell)((unsigned long long)a + (unsigned long long)b);
+    case PDO_REDUCE_MIN: return b < a ? b : a;
+    case PDO_REDUCE_MAX: return b > a ? b : a;
+    default: return 0;
+    }
+}
+
+/**
+ * Run chunks of a PDO loop on the calling thread's stacks until the range is used up
+ * Each iteration must leave the data stack as deep as before, plus one cell to reduce
+ * @param job The loop
+ * @param id Thread number, the slot for this thread's partial result
+ * @return 1 on success, 0 after reporting an error (the other threads stop early)
+ */
+int pdo_run(ParallelJob *job, int id)
+{
+    Cell acc = pdo_identity(job->reduce);
+    long errors = error_count;
+    int depth = data_stack.sp + (job->reduce != PDO_REDUCE_NONE);
+    int rbase = return_stack.sp;
+    rstack_push(job->limit);
+    rstack_push(0);
+    if (return_stack.sp != rbase + 2)
+        return 0;
+    for (;;)
+    {
+        Cell lo = __atomic_fetch_add(&job->next, job->grain, __ATOMIC_RELAXED);
+        if (lo >= job->limit || __atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+            break;
+        Cell hi = job->limit - lo > job->grain ? lo + job->grain : job->limit;
+        for (Cell n = lo; n < hi; n++)
+        {
+            return_stack.stack[rbase + 2] = n;
+            execute_word(job->body);
+            if (error_count != errors)
+            {
+                // The body has reported its error; workers leave the rest to the joining thread
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+            if (return_stack.sp != rbase + 2 || data_stack.sp != depth)
+            {
+                if (id == 0)
+                    error("PDO body left the wrong number of cells");
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+            if (job->reduce != PDO_REDUCE_NONE)
+                acc = pdo_combine(job->reduce, acc, data_stack.stack[data_stack.sp--]);
+        }
+    }
+    return_stack.sp = rbase;
+    job->results[id] = acc;
+    return 1;
+}
+
+/**
+ * Pool job of a PDO loop: worker threads start from a copy of the caller's stacks
+ */
+void pdo_thread(void *arg, int id)
+{
+    ParallelJob *job = arg;
+    if (id == 0)
+    {
+        job->ok = pdo_run(job, 0);
+        return;
+    }
+    stack_copy(&data_stack, &pdo_data);
+    stack_copy(&return_stack, &pdo_ret);
+    frame_stack.sp = -1;
+    pdo_run(job, id);
+}
+
+/**
+ * (PDO): Run xt for each index from start up to limit on the worker threads ( limit start xt kind -- [x] )
+ * kind selects a reduction of the cell each iteration leaves (PDO_REDUCE_*); the loop runs
+ * zero times when limit <= start. Loops nested in a parallel loop run on the thread they are in.
+ */
+void pdo_run_word(void)
+{
+    Cell reduce = stack_pop();
+    Word *body = xt_word(stack_pop());
+    Cell start = stack_pop();
+    Cell limit = stack_pop();
+    if (!body)
+        return;
+    if (reduce < PDO_REDUCE_NONE || reduce > PDO_REDUCE_MAX)
+    {
+        error("Unknown PDO reduction");
+        return;
+    }
+
+    ParallelJob job;
+    job.body = body;
+    job.limit = limit;
+    job.next = start;
+    job.reduce = (int)reduce;
+    job.failed = 0;
+
+    unsigned long long trips = limit > start ? (unsigned long long)limit - (unsigned long long)start : 0;
+    int threads = 1;
+    if (!parallel_active && trips >= 2 * PDO_MIN_CHUNK)
+    {
+        int available = pool_threads();
+        threads = trips / PDO_MIN_CHUNK > (unsigned long long)available ? available : (int)(trips / PDO_MIN_CHUNK);
+    }
+    unsigned long long grain = trips / ((unsigned long long)threads * PDO_CHUNKS_PER_THREAD);
+    job.grain = grain > 0 ? (Cell)grain : 1;
+
+    if (threads == 1)
+    {
+        if (!pdo_run(&job, 0))
+            return;
+    }
+    else
+    {
+        stack_copy(&pdo_data, &data_stack);
+        stack_copy(&pdo_ret, &return_stack);
+        parallel_active = 1;
+        pool_run(pdo_thread, &job, threads);
+        parallel_active = 0;
+        if (!job.ok)
+            return;
+        if (job.failed)
+        {
+            error("PDO body failed in a worker thread");
+            return;
+        }
+    }
+
+    if (job.reduce != PDO_REDUCE_NONE)
+    {
+        Cell acc = job.results[0];
+        for (int k = 1; k < threads; k++)
+            acc = pdo_combine(job.reduce, acc, job.results[k]);
+        stack_push(acc);
+    }
+}
+
+/**
+ * PDO: Start the body of a parallel counted loop ( limit start -- )
+ */
+void pdo_word(void)
+{
+    if (!state || !current_word)
+    {
+        error("PDO used outside of compilation mode");
+        return;
+    }
+    quotation_begin(QUOTE_PDO);
+}
+
+/**
+ * Finish a PDO body and compile the parallel loop
+ * @param reduce PDO_REDUCE_NONE, _SUM, _MIN or _MAX
+ */
+void ploop_end(int reduce)
+{
+    if (!quotation_end(QUOTE_PDO))
+        return;
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+    code_buffer[code_sp++] = OP_LIT;
+    code_buffer[code_sp++] = reduce;
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(pdo_run_word);
+}
+
+/**
+ * PLOOP: End a parallel loop whose body leaves nothing
+ */
+void ploop_word(void)
+{
+    ploop_end(PDO_REDUCE_NONE);
+}
+
+/**
+ * PLOOP-SUM: End a parallel loop and push the sum of the cells its iterations leave ( -- n )
+ */
+void ploop_sum_word(void)
+{
+    ploop_end(PDO_REDUCE_SUM);
+}
+
+/**
+ * PLOOP-MIN: End a parallel loop and push the smallest cell its iterations leave ( -- n )
+ */
+void ploop_min_word(void)
+{
+    ploop_end(PDO_REDUCE_MIN);
+}
+
+/**
+ * PLOOP-MAX: End a parallel loop and push the largest cell its iterations leave ( -- n )
+ */
+void ploop_max_word(void)
+{
+    ploop_end(PDO_REDUCE_MAX);
+}
+
+/**
+ * PDO-THREADS: Set how many threads a parallel loop uses, the calling one included ( n -- )
+ * 0 returns to one per available core
+ */
+void pdo_threads_word(void)
+{
+    Cell n = stack_pop();
+    if (n < 0 || n > POOL_MAX_THREADS)
+    {
+        error("PDO-THREADS out of range");
+        return;
+    }
+    pdo_threads = (int)n;
+}
+
+// Spawned children - n xt SPAWN ... SYNC for recursive divide and conquer
+//
+// SPAWN copies the top n cells and xt into a child on the spawning thread's stack of unsynced
+// children and pushes it on that thread's Chase-Lev deque. SYNC takes the children of the
+// running word back from the bottom of the deque, newest first, and runs them itself; any
+// that are missing were stolen from the top by idle threads, and SYNC runs other stolen work
+// while it waits for them. A child runs nested on whichever thread took it, so it needs no
+// stacks of its own. The first word that calls SPAWN outside a parallel region starts one:
+// the calling thread runs the word and the pool workers steal until it returns. Elsewhere
+// children only run in parallel if some thread of the region steals them.
+
+SpawnDeque spawn_deques[POOL_MAX_THREADS]; // One deque per pool thread, indexed by pool_id
+int spawn_region = 0;                      // 1 while the workers of a spawning word steal
+__thread int pool_id = 0;                  // Pool thread number (0 = the interpreter's thread)
+__thread SpawnChild spawn_stack[SPAWN_MAX]; // Children spawned on this thread and not synced
+__thread int spawn_sp = 0;                 // Entries in use in spawn_stack
+__thread int spawn_base = 0;               // First child of the running word
+__thread int spawn_nested = 0;             // Children being run by this thread
+__thread int spawn_failed = 0;             // Set by SYNC when a child of a running child failed
+__thread unsigned steal_next = 0;          // Where the next search for work starts
+
+/**
+ * Push a child at the bottom of a deque; only its thread may push
+ * SPAWN_MAX bounds the unsynced children of a thread, so the deque cannot fill up
+ */
+void deque_push(SpawnDeque *dq, SpawnChild *child)
+{
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->items[b & (SPAWN_MAX - 1)], child, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the newest child from the bottom of a deque; only its thread may take
+ * @return The child, or NULL if the deque is empty (or a thief won the last one)
+ */
+SpawnChild *deque_take(SpawnDeque *dq)
+{
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+    if (t > b)
+    {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    SpawnChild *child = __atomic_load_n(&dq->items[b & (SPAWN_MAX - 1)], __ATOMIC_RELAXED);
+    if (t == b)
+    {
+        // Last child: race the thieves for it
+        if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            child = NULL;
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+    }
+    return child;
+}
+
+/**
+ * Steal the oldest child from the top of another thread's deque
+ * @return The child, or NULL if the deque is empty or another thread got there first
+ */
+SpawnChild *deque_steal(SpawnDeque *dq)
+{
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+    SpawnChild *child = __atomic_load_n(&dq->items[t & (SPAWN_MAX - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return child;
+}
+
+/**
+ * Run a child on top of the calling thread's stacks and publish its results
+ * The stacks are restored afterwards, so an error in the child stays in the child
+ */
+void spawn_run(SpawnChild *child)
+{
+    int dbase = data_stack.sp;
+    int rbase = return_stack.sp;
+    int fbase = frame_stack.sp;
+    long errors = error_count;
+    int outer_base = spawn_base;
+    int outer_failed = spawn_failed;
+    spawn_base = spawn_sp;
+    spawn_failed = 0;
+    spawn_nested++;
+
+    child->failed = 1;
+    if (dbase + child->nargs < STACK_SIZE)
+    {
+        memcpy(&data_stack.stack[dbase + 1], child->args, child->nargs * sizeof(Cell));
+        data_stack.sp += child->nargs;
+        execute_word(child->body);
+        sync_word(); // Children the body left unsynced
+        int n = data_stack.sp - dbase;
+        if (error_count == errors && !spawn_failed && return_stack.sp == rbase && n >= 0 && n <= SPAWN_MAX_CELLS)
+        {
+            memcpy(child->results, &data_stack.stack[dbase + 1], n * sizeof(Cell));
+            child->nresults = n;
+            child->failed = 0;
+        }
+    }
+    if (child->failed && error_count == errors && !spawn_failed)
+        error("SPAWN child left a bad stack");
+
+    data_stack.sp = dbase;
+    return_stack.sp = rbase;
+    frame_stack.sp = fbase;
+    spawn_base = outer_base;
+    spawn_failed = outer_failed;
+    spawn_nested--;
+    __atomic_store_n(&child->done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Steal a child from another thread of the running job and run it
+ * @return 1 if a child was run, 0 if no thread had one to give
+ */
+int spawn_steal(void)
+{
+    int threads = pool.threads;
+    for (int k = 0; k < threads; k++)
+    {
+        int victim = (int)(steal_next++ % (unsigned)threads);
+        if (victim == pool_id)
+            continue;
+        SpawnChild *child = deque_steal(&spawn_deques[victim]);
+        if (child)
+        {
+            spawn_run(child);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Pool job of a word that spawns: thread 0 runs the word, the others steal until it is done
+ * @param arg The word
+ * @param id Thread number
+ */
+void spawn_thread(void *arg, int id)
+{
+    if (id == 0)
+    {
+        execute_code(arg);
+        sync_word();
+        __atomic_store_n(&spawn_region, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    data_stack.sp = -1;
+    return_stack.sp = -1;
+    frame_stack.sp = -1;
+    while (__atomic_load_n(&spawn_region, __ATOMIC_ACQUIRE))
+        if (!spawn_steal())
+            sched_yield();
+}
+
+/**
+ * Run a word that calls SPAWN, then wait for the children it left unsynced
+ * Outside a parallel region the word runs as a pool job, so idle threads can steal its children
+ * @param word A colon definition, DOES> behaviour or quotation
+ */
+void spawn_scope(Word *word)
+{
+    int outer_base = spawn_base;
+    spawn_base = spawn_sp;
+    if (parallel_active)
+    {
+        execute_code(word);
+        sync_word();
+    }
+    else
+    {
+        int threads = pool_threads();
+        parallel_active = 1;
+        spawn_region = 1;
+        pool_run(spawn_thread, word, threads);
+        parallel_active = 0;
+    }
+    spawn_base = outer_base;
+}
+
+/**
+ * SPAWN: Queue xt to run on a copy of the top n cells, possibly on another thread ( x1 .. xn n xt -- )
+ * SYNC pushes the cells it leaves
+ */
+void spawn_word(void)
+{
+    Word *body = xt_word(stack_pop());
+    Cell n = stack_pop();
+    if (!body)
+        return;
+    if (n < 0 || n > SPAWN_MAX_CELLS)
+    {
+        error("SPAWN cell count out of range");
+        return;
+    }
+    if (data_stack.sp + 1 < n)
+    {
+        error("Stack underflow");
+        return;
+    }
+    if (spawn_sp >= SPAWN_MAX)
+    {
+        error("Too many unsynced SPAWN children");
+        return;
+    }
+    SpawnChild *child = &spawn_stack[spawn_sp++];
+    child->body = body;
+    child->nargs = (int)n;
+    data_stack.sp -= (int)n;
+    memcpy(child->args, &data_stack.stack[data_stack.sp + 1], n * sizeof(Cell));
+    child->done = 0;
+    deque_push(&spawn_deques[pool_id], child);
+}
+
+/**
+ * SYNC: Wait for the children spawned by the running word and push what each left, in spawn order
+ * ( -- x1 .. xn )
+ */
+void sync_word(void)
+{
+    // Children still in the deque run here, newest first; once one is missing, it and all
+    // older ones were stolen
+    SpawnDeque *dq = &spawn_deques[pool_id];
+    for (int k = spawn_sp - 1; k >= spawn_base; k--)
+    {
+        SpawnChild *child = deque_take(dq);
+        if (child != &spawn_stack[k])
+        {
+            if (child)
+                deque_push(dq, child); // A child of an enclosing word
+            break;
+        }
+        spawn_run(child);
+    }
+
+    int failed = 0;
+    for (int k = spawn_base; k < spawn_sp; k++)
+    {
+        SpawnChild *child = &spawn_stack[k];
+        while (!__atomic_load_n(&child->done, __ATOMIC_ACQUIRE))
+            if (!spawn_steal())
+                sched_yield();
+        if (child->failed)
+            failed = 1;
+        else if (data_stack.sp + child->nresults >= STACK_SIZE)
+            failed = 1;
+        else
+        {
+            memcpy(&data_stack.stack[data_stack.sp + 1], child->results, child->nresults * sizeof(Cell));
+            data_stack.sp += child->nresults;
+        }
+    }
+    spawn_sp = spawn_base;
+
+    // A failure is reported once, by the word that started the region
+    if (failed)
+    {
+        if (spawn_nested > 0)
+            spawn_failed = 1;
+        else
+            error("SPAWN child failed");
+    }
+}
+
+// Channels - n CHANNEL name makes a bounded queue of cells; >CHAN and CHAN> pass cells through it
+//
+// Each slot carries a sequence number: a slot at position p can be sent to when its number
+// is p, and received from when it is p + 1; the receiver then sets it to p + capacity for the
+// next lap. Senders claim a run of free positions by advancing tail with one CAS, receivers
+// do the same with head, so a batch costs one atomic update whatever its length. A send to a
+// full or a receive from an empty channel lets the other tasks run (PAUSE), or yields the
+// CPU inside parallel code, until the other end catches up.
+
+Channel *channels[CHANNEL_MAX]; // Channels by number
+int channel_count = 0;          // Channels created
+
+/**
+ * Look up a channel
+ * @param id Channel number
+ * @return The channel, or NULL after reporting an error
+ */
+Channel *channel_get(Cell id)
+{
+    if (id < 0 || id >= channel_count)
+    {
+        error("Invalid channel");
+        return NULL;
+    }
+    return channels[id];
+}
+
+/**
+ * Send cells without waiting
+ * @param ch The channel
+ * @param cells Cells to send, in order
+ * @param n Number of cells
+ * @return Cells sent (a prefix of cells; 0 if the channel is full)
+ */
+int channel_send(Channel *ch, const Cell *cells, int n)
+{
+    long pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+    int k;
+    for (;;)
+    {
+        // Count the free slots from pos on, then claim them
+        for (k = 0; k < n; k++)
+            if (__atomic_load_n(&ch->slots[(pos + k) & ch->mask].seq, __ATOMIC_ACQUIRE) != pos + k)
+                break;
+        if (k == 0)
+        {
+            if (__atomic_load_n(&ch->slots[pos & ch->mask].seq, __ATOMIC_ACQUIRE) < pos)
+                return 0; // Full
+            pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&ch->tail, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    for (int j = 0; j < k; j++)
+    {
+        ChannelSlot *slot = &ch->slots[(pos + j) & ch->mask];
+        slot->value = cells[j];
+        __atomic_store_n(&slot->seq, pos + j + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+/**
+ * Receive cells without waiting
+ * @param ch The channel
+ * @param cells Where to put them, in order
+ * @param n Most cells wanted
+ * @return Cells received (0 if the channel is empty)
+ */
+int channel_receive(Channel *ch, Cell *cells, int n)
+{
+    long pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+    int k;
+    for (;;)
+    {
+        for (k = 0; k < n; k++)
+            if (__atomic_load_n(&ch->slots[(pos + k) & ch->mask].seq, __ATOMIC_ACQUIRE) != pos + k + 1)
+                break;
+        if (k == 0)
+        {
+            if (__atomic_load_n(&ch->slots[pos & ch->mask].seq, __ATOMIC_ACQUIRE) < pos + 1)
+                return 0; // Empty
+            pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&ch->head, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    for (int j = 0; j < k; j++)
+    {
+        ChannelSlot *slot = &ch->slots[(pos + j) & ch->mask];
+        cells[j] = slot->value;
+        __atomic_store_n(&slot->seq, pos + j + ch->mask + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+/**
+ * Give the other end of a channel a chance to run
+ * @param deadlock Error reported when no other task could ever run
+ * @return 1 to try again, 0 after reporting the error
+ */
+int channel_wait(const char *deadlock)
+{
+    if (parallel_active)
+    {
+        sched_yield();
+        return 1;
+    }
+    if (task_next() == task_current && event_waiting == 0)
+    {
+        error(deadlock);
+        return 0;
+    }
+    long errors = error_count;
+    pause_word();
+    return error_count == errors;
+}
+
+/**
+ * CHANNEL: Create a channel of at least n cells; name pushes its number ( n -- )
+ */
+void channel_word(void)
+{
+    Cell n = stack_pop();
+    char name[MAX_WORD_LEN];
+    if (!tokenize(name))
+    {
+        error("CHANNEL needs a name");
+        return;
+    }
+    if (n < 1 || n > CHANNEL_MAX_CAPACITY)
+    {
+        error("CHANNEL capacity out of range");
+        return;
+    }
+    if (channel_count >= CHANNEL_MAX)
+    {
+        error("Too many channels");
+        return;
+    }
+    long capacity = 2;
+    while (capacity < n)
+        capacity *= 2;
+    Channel *ch;
+    if (posix_memalign((void **)&ch, 64, sizeof(Channel) + capacity * sizeof(ChannelSlot)) != 0)
+    {
+        error("Memory allocation failed");
+        return;
+    }
+    ch->mask = capacity - 1;
+    ch->tail = 0;
+    ch->head = 0;
+    for (long k = 0; k < capacity; k++)
+        ch->slots[k].seq = k;
+    channels[channel_count] = ch;
+
+    Word *new_word = word_new(name);
+    new_word->code = code_alloc(name, 2);
+    new_word->code[0] = OP_LIT;
+    new_word->code[1] = channel_count;
+    new_word->code_size = 2;
+    new_word->pure = 1;
+    new_word->code_field = CODE_CONSTANT;
+    new_word->param = channel_count;
+    dict_add(new_word);
+    channel_count++;
+}
+
+/**
+ * >CHAN: Send a cell, waiting while the channel is full ( x ch -- )
+ */
+void to_chan_word(void)
+{
+    Channel *ch = channel_get(stack_pop());
+    Cell x = stack_pop();
+    if (!ch)
+        return;
+    while (!channel_send(ch, &x, 1))
+        if (!channel_wait("Channel is full and no other task can empty it"))
+            return;
+}
+
+/**
+ * CHAN>: Receive a cell, waiting while the channel is empty ( ch -- x )
+ */
+void from_chan_word(void)
+{
+    Channel *ch = channel_get(stack_pop());
+    Cell x;
+    if (!ch)
+        return;
+    while (!channel_receive(ch, &x, 1))
+        if (!channel_wait("Channel is empty and no other task can fill it"))
+            return;
+    stack_push(x);
+}
+
+/**
+ * ?CHAN>: Receive a cell if one is waiting ( ch -- x true | false )
+ */
+void try_from_chan_word(void)
+{
+    Channel *ch = channel_get(stack_pop());
+    Cell x;
+    if (!ch)
+        return;
+    if (channel_receive(ch, &x, 1))
+    {
+        stack_push(x);
+        stack_push(-1);
+    }
+    else
+    {
+        stack_push(0);
+    }
+}
+
+/**
+ * >CHAN-N: Send n cells starting at addr, as many at a time as fit ( addr n ch -- )
+ */
+void to_chan_n_word(void)
+{
+    Channel *ch = channel_get(stack_pop());
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (!ch || !range_valid(addr, n))
+        return;
+    for (Cell sent = 0; sent < n;)
+    {
+        int k = channel_send(ch, &memory[addr + sent], (int)(n - sent));
+        sent += k;
+        if (k == 0 && !channel_wait("Channel is full and no other task can empty it"))
+            return;
+    }
+}
+
+/**
+ * CHAN-N>: Receive n cells into memory starting at addr, as many at a time as are there ( addr n ch -- )
+ */
+void from_chan_n_word(void)
+{
+    Channel *ch = channel_get(stack_pop());
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (!ch || !range_valid(addr, n))
+        return;
+    for (Cell received = 0; received < n;)
+    {
+        int k = channel_receive(ch, &memory[addr + received], (int)(n - received));
+        received += k;
+        if (k == 0 && !channel_wait("Channel is empty and no other task can fill it"))
+            return;
+    }
+}
+
+// Event loop - Non-blocking I/O and timers for cooperative tasks
+//
+// A task that would block on an fd or wants to sleep parks itself: the fd goes into an epoll
+// set, tagged with the task number, or the task gets a wake-up time. Parked tasks are skipped
+// by PAUSE. The scheduler polls the set without waiting whenever some task is parked, and
+// when every task is parked it waits in epoll_wait until the first fd is ready or the first
+// timer is due. Buffers are bytes packed eight to a cell, read and written in place.
+
+int event_fd = -1;       // epoll set of the fds tasks wait on (created on first use)
+int event_waiting = 0;   // Tasks parked on an fd or a timer
+
+/**
+ * Read the monotonic clock
+ * @return Milliseconds since some fixed point
+ */
+long long clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Create the epoll set on first use
+ * @return 1 on success, 0 after reporting an error
+ */
+int event_init(void)
+{
+    if (event_fd < 0 && (event_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        error("Cannot create the event set");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Make a parked task runnable again and drop what it waited for
+ */
+void event_wake(Task *task)
+{
+    if (task->wait_fd >= 0)
+        epoll_ctl(event_fd, EPOLL_CTL_DEL, task->wait_fd, NULL);
+    task->wait_fd = -1;
+    task->wake_at = 0;
+    task->parked = 0;
+    event_waiting--;
+}
+
+/**
+ * Wake the parked tasks whose fds are ready or whose timers are due
+ * @param block 1 to wait for the first of them, 0 to only look
+ */
+void event_poll(int block)
+{
+    long long now = clock_ms();
+    long long timeout = block ? -1 : 0;
+    for (int k = 0; k < task_count; k++)
+    {
+        Task *task = tasks[k];
+        if (task->parked && task->wake_at)
+        {
+            long long left = task->wake_at > now ? task->wake_at - now : 0;
+            if (timeout < 0 || left < timeout)
+                timeout = left;
+        }
+    }
+    struct epoll_event events[EVENT_BATCH];
+    int n = epoll_wait(event_fd, events, EVENT_BATCH, timeout > INT_MAX ? INT_MAX : (int)timeout);
+    for (int k = 0; k < n; k++)
+    {
+        Task *task = tasks[events[k].data.u32];
+        if (task->parked)
+            event_wake(task);
+    }
+    now = clock_ms();
+    for (int k = 0; k < task_count; k++)
+    {
+        Task *task = tasks[k];
+        if (task->parked && task->wake_at && task->wake_at <= now)
+            event_wake(task);
+    }
+}
+
+/**
+ * Find the task that gets the next turn, waking parked tasks that are ready
+ * While no task can run, waits for an fd or a timer
+ * @return The next runnable task, the current one if it is the only one
+ */
+int task_next_ready(void)
+{
+    for (;;)
+    {
+        if (event_waiting > 0)
+            event_poll(0);
+        int next = task_next();
+        Task *self = tasks[task_current];
+        if (next != task_current || (self->active && !self->parked))
+            return next;
+        event_poll(1);
+    }
+}
+
+/**
+ * Park the current task until an fd is ready or a time has come, running the others meanwhile
+ * @param fd File descriptor to wait on (-1 = none)
+ * @param events EPOLLIN or EPOLLOUT
+ * @param wake_at clock_ms() time to wake up at (0 = none)
+ * @return 1 once woken, 0 after reporting an error
+ */
+int event_park(int fd, int events, long long wake_at)
+{
+    if (parallel_active)
+    {
+        error("Cannot wait for events inside parallel code");
+        return 0;
+    }
+    if (!event_init())
+        return 0;
+    Task *self = tasks[task_current];
+    if (fd >= 0)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.u32 = task_current;
+        if (epoll_ctl(event_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            if (errno == EPERM)
+                return 1; // Regular files are always ready
+            error(errno == EEXIST ? "Another task is waiting on this fd" : "Cannot wait on this fd");
+            return 0;
+        }
+    }
+    self->parked = 1;
+    self->wait_fd = fd;
+    self->wake_at = wake_at;
+    event_waiting++;
+    while (self->parked)
+    {
+        int next = task_next_ready();
+        if (next != task_current)
+            task_switch(next);
+    }
+    return 1;
+}
+
+/**
+ * Wait until an fd is ready, parking the current task if it is not ready yet
+ * @param fd The file descriptor
+ * @param events POLLIN or POLLOUT
+ * @return 1 when ready (or when an error will show up on the next read or write), 0 after an error
+ */
+int fd_wait(int fd, short events)
+{
+    struct pollfd p = {fd, events, 0};
+    if (poll(&p, 1, 0) != 0)
+        return 1;
+    return event_park(fd, events == POLLIN ? EPOLLIN : EPOLLOUT, 0);
+}
+
+/**
+ * READ-FD: Read up to n bytes into the buffer at addr, waiting until there are some ( addr n fd -- count )
+ * count is 0 at end of file and -1 on error
+ */
+void read_fd_word(void)
+{
+    Cell fd = stack_pop();
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (n < 0 || fd < 0 || fd > INT_MAX)
+    {
+        error("Invalid READ-FD arguments");
+        return;
+    }
+    if (!byte_range_valid(addr, n))
+        return;
+    if (!fd_wait((int)fd, POLLIN))
+        return;
+    ssize_t got;
+    do
+        got = read((int)fd, &memory[addr], (size_t)n);
+    while (got < 0 && errno == EINTR);
+    stack_push(got);
+}
+
+/**
+ * WRITE-FD: Write n bytes from the buffer at addr, waiting while the fd is full ( addr n fd -- count )
+ * count is n, or -1 on error
+ */
+void write_fd_word(void)
+{
+    Cell fd = stack_pop();
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (n < 0 || fd < 0 || fd > INT_MAX)
+    {
+        error("Invalid WRITE-FD arguments");
+        return;
+    }
+    if (!byte_range_valid(addr, n))
+        return;
+    unsigned char *buffer = (unsigned char *)&memory[addr];
+    for (Cell done = 0; done < n;)
+    {
+        if (!fd_wait((int)fd, POLLOUT))
+            return;
+        // POLLOUT promises room, not room for everything: sockets are written without blocking,
+        // other fds PIPE_BUF bytes at a time, which a writable pipe always takes at once
+        size_t len = (size_t)(n - done);
+        ssize_t put = send((int)fd, buffer + done, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (put < 0 && errno == ENOTSOCK)
+            put = write((int)fd, buffer + done, len < PIPE_BUF ? len : PIPE_BUF);
+        if (put < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            stack_push(-1);
+            return;
+        }
+        if (put > 0)
+            done += put;
+    }
+    stack_push(n);
+}
+
+/**
+ * WAIT-READABLE: Let the other tasks run until fd has data or is at end of file ( fd -- )
+ */
+void wait_readable_word(void)
+{
+    Cell fd = stack_pop();
+    if (fd < 0 || fd > INT_MAX)
+    {
+        error("Invalid fd");
+        return;
+    }
+    fd_wait((int)fd, POLLIN);
+}
+
+/**
+ * MS: Let the other tasks run for at least n milliseconds ( n -- )
+ */
+void ms_word(void)
+{
+    Cell n = stack_pop();
+    if (n > 0)
+        event_park(-1, 0, clock_ms() + n);
+}
+
+/**
+ * AFTER: Make a task run xt from the start once n milliseconds have passed ( xt n task -- )
+ */
+void after_word(void)
+{
+    Task *task = task_get(stack_pop(), 0);
+    Cell n = stack_pop();
+    Word *w = xt_word(stack_pop());
+    if (!task || !w || !event_init())
+        return;
+    if (task == tasks[task_current])
+    {
+        error("A task cannot schedule itself with AFTER");
+        return;
+    }
+    if (task->parked)
+        event_wake(task);
+    task_unwind(task);
+    if (!task_start(task, w))
+        return;
+    task->parked = 1;
+    task->wait_fd = -1;
+    task->wake_at = clock_ms() + (n > 0 ? n : 0);
+    event_waiting++;
+}
+
+/**
+ * PIPE: Create a pipe ( -- read-fd write-fd )
+ */
+void pipe_word(void)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        error("Cannot create a pipe");
+        return;
+    }
+    stack_push(fds[0]);
+    stack_push(fds[1]);
+}
+
+/**
+ * CLOSE-FD: Close a file descriptor ( fd -- )
+ */
+void close_fd_word(void)
+{
+    Cell fd = stack_pop();
+    if (fd < 0 || fd > INT_MAX || close((int)fd) != 0)
+        error("Cannot close fd");
+}
+
+// Asynchronous file I/O - Batches of reads and writes on an io_uring
+//
+// URING-READ and URING-WRITE fill submission queue entries whose buffers are memory[]
+// itself, bytes packed eight to a cell, so the kernel moves data straight into or out of
+// the data space; BYTE@ and BYTE! get at the bytes. Nothing reaches the kernel until
+// URING-SUBMIT (or a full queue, or a wait), which hands over the whole batch with one
+// io_uring_enter. Completions come back as ( addr result ), addr naming the request by its
+// buffer. The ring fd becomes readable when completions are waiting, so URING-WAIT parks
+// the current task on the event loop rather than blocking the other tasks.
+
+Uring uring = {.fd = -1}; // Set up by the first request
+
+/**
+ * Set up the io_uring instance and map its rings on first use
+ * @return 1 on success, 0 after reporting an error
+ */
+int uring_init(void)
+{
+    if (uring.fd >= 0)
+        return 1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0)
+    {
+        error("io_uring is not available");
+        return 0;
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        close(fd);
+        error("Cannot map the io_uring rings");
+        return 0;
+    }
+    uring.entries = params.sq_entries;
+    uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring.sqes = sqes;
+    uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring.fd = fd;
+    return 1;
+}
+
+/**
+ * Hand the queued requests to the kernel
+ * @return 1 on success, 0 after reporting an error
+ */
+int uring_submit(void)
+{
+    while (uring.queued > 0)
+    {
+        int n = (int)syscall(__NR_io_uring_enter, uring.fd, uring.queued, 0, 0, NULL, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            error("io_uring submission failed");
+            return 0;
+        }
+        uring.queued -= n;
+        uring.in_flight += n;
+    }
+    return 1;
+}
+
+/**
+ * Queue a read or write of n bytes at a file offset ( fd addr n offset -- )
+ * The bytes go to or come from memory[] starting at cell addr
+ * @param opcode IORING_OP_READ or IORING_OP_WRITE
+ */
+void uring_queue(int opcode)
+{
+    Cell offset = stack_pop();
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    Cell fd = stack_pop();
+    if (fd < 0 || fd > INT_MAX || n < 0 || n > UINT_MAX || offset < 0)
+    {
+        error("Invalid io_uring request");
+        return;
+    }
+    if (!byte_range_valid(addr, n) || !uring_init())
+        return;
+    if (uring.queued + uring.in_flight >= 2 * uring.entries)
+    {
+        error("Too many io_uring requests in flight");
+        return;
+    }
+    if (uring.queued == uring.entries && !uring_submit())
+        return;
+
+    unsigned tail = *uring.sq_tail;
+    unsigned index = tail & *uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = (int)fd;
+    sqe->addr = (unsigned long long)(uintptr_t)&memory[addr];
+    sqe->len = (unsigned)n;
+    sqe->off = (unsigned long long)offset;
+    sqe->user_data = (unsigned long long)addr;
+    uring.sq_array[index] = index;
+    __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring.queued++;
+}
+
+/**
+ * Take one completion and push it ( -- addr result true | false )
+ * @return 1 if there was one
+ */
+int uring_reap(void)
+{
+    if (uring.fd < 0)
+        return 0;
+    unsigned head = *uring.cq_head;
+    if (head == __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+    stack_push((Cell)cqe->user_data);
+    stack_push(cqe->res);
+    __atomic_store_n(uring.cq_head, head + 1, __ATOMIC_RELEASE);
+    uring.in_flight--;
+    return 1;
+}
+
+/**
+ * OPEN-FILE: Open the file named by the n bytes of the buffer at addr ( addr n mode -- fd )
+ * mode 0 reads, 1 writes (creating or truncating the file), 2 does both (creating it);
+ * fd is -1 if the file cannot be opened
+ */
+void open_file_word(void)
+{
+    static const int flags[] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_RDWR | O_CREAT};
+    Cell mode = stack_pop();
+    Cell n = stack_pop();
+    Cell addr = stack_pop();
+    if (mode < 0 || mode > 2 || n < 1 || n >= PATH_MAX)
+    {
+        error("Invalid OPEN-FILE arguments");
+        return;
+    }
+    if (!byte_range_valid(addr, n))
+        return;
+    char path[PATH_MAX];
+    memcpy(path, &memory[addr], (size_t)n);
+    path[n] = '\0';
+    stack_push(open(path, flags[mode] | O_CLOEXEC, 0644));
+}
+
+/**
+ * URING-READ: Queue a read of n bytes at offset of fd into memory from addr ( fd addr n offset -- )
+ */
+void uring_read_word(void)
+{
+    uring_queue(IORING_OP_READ);
+}
+
+/**
+ * URING-WRITE: Queue a write of n bytes from memory at addr to offset of fd ( fd addr n offset -- )
+ */
+void uring_write_word(void)
+{
+    uring_queue(IORING_OP_WRITE);
+}
+
+/**
+ * URING-SUBMIT: Start the queued requests with one system call ( -- n )
+ */
+void uring_submit_word(void)
+{
+    unsigned queued = uring.queued;
+    if (queued == 0 || uring_submit())
+        stack_push(queued);
+}
+
+/**
+ * URING-POLL: Take a finished request if there is one ( -- addr result true | false )
+ * result is the byte count, or a negated errno
+ */
+void uring_poll_word(void)
+{
+    if (uring_reap())
+        stack_push(-1);
+    else
+        stack_push(0);
+}
+
+/**
+ * URING-WAIT: Wait for a request to finish, letting the other tasks run ( -- addr result )
+ * Queued requests are submitted first
+ */
+void uring_wait_word(void)
+{
+    if (uring.queued > 0 && !uring_submit())
+        return;
+    while (!uring_reap())
+    {
+        if (uring.in_flight == 0)
+        {
+            error("No io_uring requests in flight");
+            return;
+        }
+        if (!fd_wait(uring.fd, POLLIN))
+            return;
+    }
+}
+
+/**
+ * Check a byte position in a buffer
+ * @param addr Cell address of the buffer
+ * @param i Byte index from its start
+ * @return The byte, or NULL after reporting an error
+ */
+unsigned char *byte_at(Cell addr, Cell i)
+{
+    if (addr < 0 || i < 0 || i / (Cell)sizeof(Cell) >= STACK_SIZE - addr)
+    {
+        error("Invalid memory address");
+        return NULL;
+    }
+    return (unsigned char *)&memory[addr] + i;
+}
+
+/**
+ * BYTE@: Fetch byte i of the buffer at addr ( addr i -- byte )
+ */
+void byte_fetch_word(void)
+{
+    Cell i = stack_pop();
+    unsigned char *byte = byte_at(stack_pop(), i);
+    if (byte)
+        stack_push(*byte);
+}
+
+/**
+ * BYTE!: Store the low byte of x as byte i of the buffer at addr ( x addr i -- )
+ */
+void byte_store_word(void)
+{
+    Cell i = stack_pop();
+    unsigned char *byte = byte_at(stack_pop(), i);
+    Cell x = stack_pop();
+    if (byte)
+        *byte = (unsigned char)x;
+}
+
+// Instruction budget - Preemption and step limits counted at backward branches and calls
+//
+// Every loop iteration and every call from a definition takes one step off step_budget;
+// straight-line code is not counted, so the check costs a decrement and a compare only
+// where a word can keep running. When the budget runs out, step_expired() charges the
+// steps to the running context: past its STEP-LIMIT the word is aborted, otherwise, with a
+// TIME-SLICE set, the context is preempted exactly as if it had called PAUSE there. An
+// aborted word reports an error and sets step_aborted, which makes every word it is nested
+// in return at once, back to the REPL, or to the end of the task or coroutine.
+
+__thread long step_budget = LONG_MAX; // Never runs out on threads that do not refill it
+__thread long step_grant = LONG_MAX;
+__thread int step_aborted = 0;
+long time_slice = 0;
+long step_limit = 0;
+
+/**
+ * Give the running context a new budget: a turn of TIME-SLICE steps, no more than the
+ * steps it has left under STEP-LIMIT
+ */
+void step_refill(void)
+{
+    long grant = time_slice > 0 ? time_slice : LONG_MAX;
+    Task *self = tasks[task_current]->top;
+    if (step_limit > 0 && self->steps_left < grant)
+        grant = self->steps_left > 0 ? self->steps_left : 1;
+    step_grant = step_budget = grant;
+}
+
+/**
+ * Start counting a word run from the REPL with the whole STEP-LIMIT
+ */
+void step_begin(void)
+{
+    tasks[task_current]->top->steps_left = step_limit;
+    step_aborted = 0;
+    step_refill();
+}
+
+/**
+ * Handle a budget that has run out at a backward branch or call
+ * Parallel code only gets a new budget, as it can neither be preempted nor stopped alone
+ * @return 1 to continue, 0 when the word has been aborted
+ */
+int step_expired(void)
+{
+    if (!parallel_active)
+    {
+        Task *self = tasks[task_current]->top;
+        self->steps_left -= step_grant - step_budget;
+        step_grant = step_budget;
+        if (step_limit > 0 && self->steps_left <= 0)
+        {
+            error("Step limit exceeded");
+            step_aborted = 1;
+            return 0;
+        }
+        // Preempt only where an explicit PAUSE would be safe
+        if (time_slice > 0 && spawn_sp == 0 && !current_word)
+        {
+            pause_word();
+            return 1; // Switching back refilled the budget
+        }
+    }
+    step_refill();
+    return 1;
+}
+
+/**
+ * TIME-SLICE: Preempt the running task after n steps ( n -- )
+ * 0 turns preemption off
+ */
+void time_slice_word(void)
+{
+    Cell n = stack_pop();
+    if (n < 0)
+    {
+        error("Invalid time slice");
+        return;
+    }
+    time_slice = (long)n;
+    step_refill();
+}
+
+/**
+ * STEP-LIMIT: Abort a command, task or coroutine once it has taken n steps ( n -- )
+ * 0 removes the limit; the contexts already running start counting again
+ */
+void step_limit_word(void)
+{
+    Cell n = stack_pop();
+    if (n < 0)
+    {
+        error("Invalid step limit");
+        return;
+    }
+    step_limit = (long)n;
+    for (int k = 0; k < task_count; k++)
+        tasks[k]->steps_left = step_limit;
+    step_refill();
+}
+
+/**
+ * BEGIN: Mark the start of a loop construct
+ * Pushes current position to branch stack for UNTIL/WHILE to reference
+ */
+void begin_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        branch_stack_push(code_sp, CF_BEGIN); // Mark loop start position
+    }
+    else
+    {
+        error("BEGIN used outside of compilation mode");
+    }
+}
+
+/**
+ * UNTIL: End a begin-until loop with conditional test
+ * Compiles conditional branch back to BEGIN if top of stack is false (0)
+ */
+void until_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        if (branch_stack_empty())
+        {
+            error("UNTIL without matching BEGIN");
+            return;
+        }
+
+        BranchEntry entry = branch_stack_pop();
+        if (entry.type != CF_BEGIN)
+        {
+            error("UNTIL without matching BEGIN");
+            return;
+        }
+
+        // Compile conditional branch back to BEGIN
+        code_buffer[code_sp++] = OP_0BRANCH; // Branch if false
+        code_buffer[code_sp++] = OP_LIT;     // Literal marker
+        // Negative offset to branch backward to BEGIN
+        code_buffer[code_sp++] = (entry.origin - code_sp);
+    }
+    else
+    {
+        error("UNTIL used outside of compilation mode");
+    }
+}
+
+/**
+ * WHILE: Conditional test within begin-while-repeat loop
+ * Compiles conditional branch to exit loop if condition is false
+ */
+void while_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        if (branch_stack_empty())
+        {
+            error("WHILE without matching BEGIN");
+            return;
+        }
+
+        BranchEntry entry = branch_stack_peek();
+        if (entry.type != CF_BEGIN)
+        {
+            error("WHILE without matching BEGIN");
+            return;
+        }
+
+        // Compile conditional exit branch (like IF)
+        branch_stack_push(code_sp, CF_WHILE);
+        code_buffer[code_sp++] = OP_0BRANCH; // Branch if false
+        code_buffer[code_sp++] = OP_LIT;     // Literal marker
+        code_buffer[code_sp++] = 0;          // Placeholder for exit offset
+    }
+    else
+    {
+        error("WHILE used outside of compilation mode");
+    }
+}
+
+/**
+ * REPEAT: Complete begin-while-repeat loop structure
+ * Compiles unconditional branch back to BEGIN and fixes WHILE exit offset
+ */
+void repeat_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        if (branch_stack_empty())
+        {
+            error("REPEAT without matching BEGIN-WHILE");
+            return;
+        }
+
+        BranchEntry while_entry = branch_stack_pop();
+        if (while_entry.type != CF_WHILE)
+        {
+            error("REPEAT without matching WHILE");
+            return;
+        }
+
+        if (branch_stack_empty())
+        {
+            error("REPEAT without matching BEGIN");
+            return;
+        }
+
+        BranchEntry begin_entry = branch_stack_pop();
+        if (begin_entry.type != CF_BEGIN)
+        {
+            error("REPEAT without matching BEGIN");
+            return;
+        }
+
+        // Compile unconditional branch back to BEGIN
+        code_buffer[code_sp++] = OP_BRANCH; // Always branch
+        code_buffer[code_sp++] = OP_LIT;    // Literal marker
+        // Negative offset to branch backward to BEGIN
+        code_buffer[code_sp++] = (begin_entry.origin - code_sp);
+
+        // Fix WHILE branch to exit to current position (after loop)
+        code_buffer[while_entry.origin + 2] = code_sp - (while_entry.origin + 2);
+    }
+    else
+    {
+        error("REPEAT used outside of compilation mode");
+    }
+}
+
+/**
+ * DO: Start a counted loop (limit start -- )
+ * Pops start and limit from stack, pushes them to return stack for LOOP
+ */
+void do_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        branch_stack_push(code_sp, CF_DO); // Track loop start
+        code_buffer[code_sp++] = OP_DO;    // Compile DO opcode
+    }
+    else
+    {
+        error("DO used outside of compilation mode");
+    }
+}
+
+/**
+ * LOOP: End a DO loop, increment index and test against limit
+ * Compiles LOOP opcode with backward branch offset to DO position
+ */
+void loop_word(void)
+{
+    if (state) // Only works in compile mode
+    {
+        if (branch_stack_empty())
+        {
+            error("LOOP without matching DO");
+            return;
+        }
+
+        BranchEntry entry = branch_stack_pop();
+        if (entry.type != CF_DO)
+        {
+            error("LOOP without matching DO");
+            return;
+        }
+
+        code_buffer[code_sp++] = OP_LOOP; // Compile LOOP opcode
+        code_buffer[code_sp++] = OP_LIT;  // Literal marker
+        // Backward offset to branch to instruction after DO
+        code_buffer[code_sp++] = (entry.origin + 1 - code_sp);
+    }
+    else
+    {
+        error("LOOP used outside of compilation mode");
+    }
+}
+
+// Multi-way branch - case ... of ... endof ... endcase
+//
+// Each clause first compiles to the generic test "selector over = if drop body else ...".
+// When ENDCASE finds that every selector is a single literal, the whole case is rewritten
+// into one dispatch instruction: a jump table indexed by the selector when the values are
+// dense, or a binary search over the sorted values otherwise. Either is followed by one
+// OP_BRANCH entry per table slot so the optimizer passes can relocate the targets.
+
+CaseFrame case_stack[CASE_MAX_NEST];   // Cases being compiled
+int case_sp = -1;                      // Top of case_stack
+Cell case_keys[CASE_KEYS_MAX];         // Sorted selectors used by OP_BSEARCH dispatches
+int case_key_count = 0;                // Cells in use in case_keys
+Cell case_code[STACK_SIZE];            // Scratch buffer for rewriting a case
+
+/**
+ * CASE: Start a multi-way branch on the top of stack
+ */
+void case_word(void)
+{
+    if (!state)
+    {
+        error("CASE used outside of compilation mode");
+        return;
+    }
+    if (case_sp + 1 >= CASE_MAX_NEST)
+    {
+        error("CASE nested too deeply");
+        return;
+    }
+    CaseFrame *frame = &case_stack[++case_sp];
+    frame->start = code_sp;
+    frame->count = 0;
+    branch_stack_push(code_sp, CF_CASE);
+}
+
+/**
+ * OF: Compile the test of a clause against the selector compiled since the previous clause
+ */
+void of_word(void)
+{
+    if (!state)
+    {
+        error("OF used outside of compilation mode");
+        return;
+    }
+    if (branch_stack_empty() || branch_stack_peek().type != CF_CASE)
+    {
+        error("OF without matching CASE");
+        return;
+    }
+    CaseFrame *frame = &case_stack[case_sp];
+    if (frame->count >= CASE_MAX_CLAUSES || code_sp + 6 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+
+    CaseClause *clause = &frame->clauses[frame->count++];
+    int clause_start = frame->count > 1 ? frame->clauses[frame->count - 2].endof + 3 : frame->start;
+    clause->literal = code_sp - clause_start == 2 && code_buffer[clause_start] == OP_LIT;
+    clause->key = clause->literal ? code_buffer[clause_start + 1] : 0;
+
+    // Generic test: over = if drop (a selector that does not match stays on the stack)
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(over);
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(equal);
+    branch_stack_push(code_sp, CF_OF);
+    code_buffer[code_sp++] = OP_0BRANCH; // Conditional branch opcode
+    code_buffer[code_sp++] = OP_LIT;     // Literal marker
+    code_buffer[code_sp++] = 0;          // Placeholder for branch offset
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(drop);
+    clause->body = code_sp;
+}
+
+/**
+ * ENDOF: End a clause with a branch to the end of the case
+ */
+void endof_word(void)
+{
+    if (!state)
+    {
+        error("ENDOF used outside of compilation mode");
+        return;
+    }
+    if (branch_stack_empty() || branch_stack_peek().type != CF_OF)
+    {
+        error("ENDOF without matching OF");
+        return;
+    }
+    if (code_sp + 3 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+
+    BranchEntry entry = branch_stack_pop();
+    CaseFrame *frame = &case_stack[case_sp];
+    frame->clauses[frame->count - 1].endof = code_sp;
+    code_buffer[code_sp++] = OP_BRANCH; // Unconditional branch
+    code_buffer[code_sp++] = OP_LIT;    // Literal marker
+    code_buffer[code_sp++] = 0;         // Placeholder for offset, patched by ENDCASE
+
+    // A failed test skips to the next clause
+    code_buffer[entry.origin + 2] = code_sp - (entry.origin + 2);
+}
+
+/**
+ * Rewrite a finished case with only literal selectors into a table or binary search dispatch
+ * @param frame The case
+ * @param default_start Code offset of the default code
+ * @param default_end Code offset of the final drop of the selector
+ */
+void case_compile_dispatch(CaseFrame *frame, int default_start, int default_end)
+{
+    int order[CASE_MAX_CLAUSES]; // Clauses with distinct selectors, sorted by selector
+    int unique = 0;
+    Cell drop_word = (Cell)dict_find_builtin(drop);
+
+    if (frame->count == 0)
+        return;
+    for (int k = 0; k < frame->count; k++)
+    {
+        if (!frame->clauses[k].literal)
+            return;
+
+        // Insertion sort; the first clause with a given selector wins
+        Cell key = frame->clauses[k].key;
+        int at = unique;
+        while (at > 0 && frame->clauses[order[at - 1]].key > key)
+            at--;
+        if (at > 0 && frame->clauses[order[at - 1]].key == key)
+            continue;
+        memmove(&order[at + 1], &order[at], (unique - at) * sizeof(int));
+        order[at] = k;
+        unique++;
+    }
+
+    Cell min = frame->clauses[order[0]].key;
+    // max - min, without the + 1 that wraps to 0 when the keys run from LLONG_MIN to LLONG_MAX
+    unsigned long long distance = (unsigned long long)frame->clauses[order[unique - 1]].key - (unsigned long long)min;
+    int dense = distance < STACK_SIZE / 8 && distance < 2 * (unsigned long long)unique;
+    int entries = dense ? (int)distance + 1 : unique;
+
+    int size = 7 + 3 * entries + (default_end - default_start) + 1;
+    for (int k = 0; k < frame->count; k++)
+        size += 1 + (frame->clauses[k].endof - frame->clauses[k].body) + 3;
+    if (frame->start + size > STACK_SIZE || (!dense && case_key_count + unique > CASE_KEYS_MAX))
+        return;
+
+    // Clause bodies, each with the selector dropped first and a branch to the end
+    int body_pos[CASE_MAX_CLAUSES];
+    int n = 7 + 3 * entries;
+    for (int k = 0; k < frame->count; k++)
+    {
+        CaseClause *clause = &frame->clauses[k];
+        body_pos[k] = n;
+        case_code[n++] = drop_word;
+        memcpy(&case_code[n], &code_buffer[clause->body], (clause->endof - clause->body) * sizeof(Cell));
+        n += clause->endof - clause->body;
+        case_code[n++] = OP_BRANCH;
+        case_code[n++] = OP_LIT;
+        case_code[n] = size - n; // The case ends at offset size
+        n++;
+    }
+    int default_pos = n;
+    memcpy(&case_code[n], &code_buffer[default_start], (default_end - default_start) * sizeof(Cell));
+    n += default_end - default_start;
+    case_code[n++] = drop_word;
+
+    // Dispatch instruction and its entries
+    case_code[0] = dense ? OP_JTAB : OP_BSEARCH;
+    case_code[1] = OP_LIT;
+    case_code[2] = default_pos - 2;
+    case_code[3] = OP_LIT;
+    case_code[4] = dense ? min : case_key_count;
+    case_code[5] = OP_LIT;
+    case_code[6] = entries;
+    for (int e = 0; e < entries; e++)
+    {
+        int target = default_pos;
+        if (!dense)
+        {
+            case_keys[case_key_count + e] = frame->clauses[order[e]].key;
+            target = body_pos[order[e]];
+        }
+        for (int k = 0; k < unique && dense; k++)
+        {
+            if ((unsigned long long)frame->clauses[order[k]].key - (unsigned long long)min == (unsigned long long)e)
+                target = body_pos[order[k]];
+        }
+        int at = 7 + 3 * e;
+        case_code[at] = OP_BRANCH;
+        case_code[at + 1] = OP_LIT;
+        case_code[at + 2] = target - (at + 2);
+    }
+    if (!dense)
+        case_key_count += unique;
+
+    memcpy(&code_buffer[frame->start], case_code, n * sizeof(Cell));
+    code_sp = frame->start + n;
+}
+
+/**
+ * ENDCASE: Drop the selector, resolve the clause exits and pick the dispatch
+ */
+void endcase_word(void)
+{
+    if (!state)
+    {
+        error("ENDCASE used outside of compilation mode");
+        return;
+    }
+    if (branch_stack_empty() || branch_stack_peek().type != CF_CASE)
+    {
+        error("ENDCASE without matching CASE");
+        return;
+    }
+    if (code_sp + 1 > STACK_SIZE)
+    {
+        error("Code buffer overflow");
+        return;
+    }
+
+    branch_stack_pop();
+    CaseFrame *frame = &case_stack[case_sp--];
+    int default_start = frame->count ? frame->clauses[frame->count - 1].endof + 3 : frame->start;
+    int default_end = code_sp;
+    code_buffer[code_sp++] = (Cell)dict_find_builtin(drop);
+    for (int k = 0; k < frame->count; k++)
+    {
+        int endof = frame->clauses[k].endof;
+        code_buffer[endof + 2] = code_sp - (endof + 2);
+    }
+    case_compile_dispatch(frame, default_start, default_end);
+}
+
+/**
+ * Find the entry of a dispatch instruction for a selector
+ * @param op OP_JTAB or OP_BSEARCH
+ * @param x The selector
+ * @param base Smallest selector (OP_JTAB) or case_keys index (OP_BSEARCH)
+ * @param count Number of entries
+ * @return Entry index, or -1 for the default
+ */
+Cell case_dispatch(Cell op, Cell x, Cell base, Cell count)
+{
+    if (op == OP_JTAB)
+    {
+        unsigned long long index = (unsigned long long)x - (unsigned long long)base;
+        return index < (unsigned long long)count ? (Cell)index : -1;
+    }
+    const Cell *keys = &case_keys[base];
+    Cell lo = 0, hi = count - 1;
+    while (lo <= hi)
+    {
+        Cell mid = (lo + hi) / 2;
+        if (keys[mid] == x)
+            return mid;
+        if (keys[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+// Optimizer - Stack-to-SSA middle-end run over each colon definition at semicolon time
+//
+// Every basic block is split into straight-line segments of instructions that can be
+// executed symbolically (literals, stack shuffles, pure built-ins). Symbolic execution
+// turns stack slots into SSA values, which gives copy propagation of shuffles, common
+// subexpression elimination, constant folding and dead-code elimination. Segments are
+// lowered back to threaded code with OP_PICK/OP_SLIDE and frame slots, and a lowering
+// is only kept when it takes fewer dispatches than the original instructions.
+// Loop-invariant values of single-block BEGIN/UNTIL and DO/LOOP bodies are hoisted
+// into frame slots computed once before the loop.
+
+// Built-in words with no side effects beyond the data stack
+const PureOp pure_ops[] = {
+    {plus, 2, 0},          {minus, 2, 0},        {star, 2, 0},         {slash, 2, 1},
+    {mod, 2, 1},           {equal, 2, 0},        {less_than, 2, 0},    {greater_than, 2, 0},
+    {less_equal, 2, 0},    {greater_equal, 2, 0}, {not_equal, 2, 0},   {and_op, 2, 0},
+    {or_op, 2, 0},         {not_op, 1, 0},       {i_word, 0, 0},       {j_word, 0, 0},
+    {one_plus, 1, 0},      {one_minus, 1, 0},    {two_star, 1, 0},     {two_slash, 1, 0},
+    {negate, 1, 0},        {abs_op, 1, 0},       {min_op, 2, 0},       {max_op, 2, 0},
+    {zero_equal, 1, 0},    {xor_op, 2, 0},       {lshift, 2, 0},       {rshift, 2, 0},
+};
+
+// Stack shuffles, described by which input each output is a copy of
+const ShuffleOp shuffle_ops[] = {
+    {dup_op, 1, 2, {0, 0}},  {drop, 1, 0, {0}},        {swap, 2, 2, {1, 0}},    {over, 2, 3, {0, 1, 0}},
+    {rot, 3, 3, {1, 2, 0}}, {nip, 2, 1, {1}},       {tuck, 2, 3, {1, 0, 1}}, {two_dup, 2, 4, {0, 1, 0, 1}},
+    {two_drop, 2, 0, {0}},  {two_swap, 4, 4, {2, 3, 0, 1}}, {two_over, 4, 6, {0, 1, 2, 3, 0, 1}},
+    {minus_rot, 3, 3, {2, 0, 1}},
+};
+
+#define PURE_OP_COUNT (int)(sizeof(pure_ops) / sizeof(pure_ops[0]))
+#define SHUFFLE_OP_COUNT (int)(sizeof(shuffle_ops) / sizeof(shuffle_ops[0]))
+
+// Optimizer working storage - sized for the largest code buffer
+IRSegment ir_segment;                  // Segment currently being lifted
+IRSegment ir_loop_segment;             // Loop body analysed for invariant code motion
+IRItem lower_items[2 * STACK_SIZE];    // Modelled stack while lowering
+int lower_top = -1;                    // Top of the modelled stack
+int lower_uses[IR_MAX_NODES];          // Remaining references to each value
+int lower_reg[IR_MAX_NODES];           // Frame slot holding each value (-1 if none)
+int lower_mark[IR_MAX_NODES];          // Visit stamps for reference counting
+int lower_stamp = 0;                   // Current visit stamp
+int lower_next_reg = 0;                // Next free frame slot for temporaries
+int lower_max_reg = 0;                 // Highest frame slot used so far (exclusive)
+
+Insn opt_insns[STACK_SIZE];            // Decoded instructions of the definition
+int opt_index[STACK_SIZE + 1];         // Instruction index at each code offset (-1 = operand)
+char opt_leader[STACK_SIZE + 1];       // 1 = instruction starts a basic block
+int opt_entry_pos[STACK_SIZE + 1];     // New offset of each block start
+int opt_back_pos[STACK_SIZE + 1];      // New offset of loop bodies after hoisted code
+int opt_fix_at[STACK_SIZE];            // New offsets of branch operands to patch
+int opt_fix_target[STACK_SIZE];        // Target instruction of each patched branch
+char opt_fix_back[STACK_SIZE];         // 1 = branch is the back edge of a hoisted loop
+int opt_fix_count = 0;                 // Number of branches to patch
+Cell opt_out[STACK_SIZE];              // Optimized code being built
+Cell opt_tmp[STACK_SIZE];              // Scratch buffer for trial lowerings
+Cell opt_body[STACK_SIZE];             // Lowered DO loop body waiting to be emitted
+int opt_body_size = 0;                 // Cells in opt_body
+int opt_body_block = -1;               // Block start opt_body belongs to (-1 = none)
+int opt_next_reg = 0;                  // Next frame slot for hoisted values
+
+/**
+ * Check whether a code cell holds a word pointer (same test as execute_word)
+ * @param item The code cell
+ * @return 1 if the cell is a word reference, 0 otherwise
+ */
+int is_word_pointer(Cell item)
+{
+    return item > 1000 && item < 10000000000000000LL;
+}
+
+/**
+ * Check whether an opcode is a branch with an offset operand
+ * @param op The opcode
+ * @return 1 for OP_BRANCH, OP_0BRANCH, OP_LOOP, OP_LOOPK and the case dispatches, 0 otherwise
+ */
+int is_branch_op(Cell op)
+{
+    return op == OP_BRANCH || op == OP_0BRANCH || op == OP_LOOP || op == OP_LOOPK || op == OP_JTAB ||
+           op == OP_BSEARCH;
+}
+
+/**
+ * Number of cells occupied by the instruction starting with a given code cell
+ * @param op The first cell of the instruction
+ * @return Instruction length in cells
+ */
+int insn_length(Cell op)
+{
+    if (op == OP_LIT)
+        return 2;
+    if (op == OP_JTAB || op == OP_BSEARCH)
+        return 7;
+    if (op == OP_SLIDE || op == OP_LOOPK)
+        return 5;
+    if (is_branch_op(op) || op == OP_PICK || op == OP_RGET || op == OP_RSET || op == OP_DOES ||
+        op == OP_COMPILE || (op <= OP_SHL && op >= OP_MODK) || (op <= OP_MAP && op >= OP_FOR_EACH))
+        return 3;
+    return 1;
+}
+
+/**
+ * Decode the instruction starting at pos in a code array
+ * Small literals stored without OP_LIT are decoded as a one-cell OP_LIT
+ * @param code The code array
+ * @param pos Offset of the instruction
+ * @param insn Receives the decoded instruction
+ * @return Number of cells the instruction occupies
+ */
+int insn_decode(const Cell *code, int pos, Insn *insn)
+{
+    Cell op = code[pos];
+    insn->pos = pos;
+    insn->op = op;
+    insn->arg[0] = 0;
+    insn->arg[1] = 0;
+    insn->arg[2] = 0;
+    insn->target = -1;
+    insn->len = insn_length(op);
+
+    if (op == OP_LIT)
+    {
+        insn->arg[0] = code[pos + 1];
+    }
+    else if (insn->len >= 3)
+    {
+        insn->arg[0] = code[pos + 2];
+        if (insn->len >= 5)
+            insn->arg[1] = code[pos + 4];
+        if (insn->len >= 7)
+            insn->arg[2] = code[pos + 6];
+    }
+    else if (op != OP_DO && !is_word_pointer(op))
+    {
+        insn->op = OP_LIT;
+        insn->arg[0] = op;
+    }
+    return insn->len;
+}
+
+/**
+ * Reset a segment to an empty symbolic stack
+ * @param seg The segment to reset
+ */
+void ir_reset(IRSegment *seg)
+{
+    seg->count = 0;
+    seg->sp = -1;
+    seg->depth = 0;
+    seg->cost = 0;
+}
+
+/**
+ * Find or create an SSA value (value numbering gives common subexpression elimination)
+ * @param seg The segment
+ * @param kind Kind of value
+ * @param value Constant, entry slot or frame slot
+ * @param op Word pointer for operations
+ * @param args Operand value ids (deepest first)
+ * @param nargs Number of operands
+ * @return The value id
+ */
+int ir_node(IRSegment *seg, IRKind kind, Cell value, Cell op, const int *args, int nargs)
+{
+    for (int k = 0; k < seg->count; k++)
+    {
+        IRNode *node = &seg->nodes[k];
+        if (node->kind == kind && node->value == value && node->op == op && node->nargs == nargs &&
+            (nargs == 0 || memcmp(node->args, args, nargs * sizeof(int)) == 0))
+        {
+            return k;
+        }
+    }
+
+    IRNode *node = &seg->nodes[seg->count];
+    node->kind = kind;
+    node->value = value;
+    node->op = op;
+    node->nargs = nargs;
+    node->reg = -1;
+    for (int k = 0; k < nargs; k++)
+    {
+        node->args[k] = args[k];
+    }
+    return seg->count++;
+}
+
+/**
+ * Pop a value from the symbolic stack, reaching below the segment when it is empty
+ * @param seg The segment
+ * @return The value id
+ */
+int ir_pop(IRSegment *seg)
+{
+    if (seg->sp >= 0)
+    {
+        return seg->stack[seg->sp--];
+    }
+    return ir_node(seg, IR_ENTRY, seg->depth++, 0, NULL, 0);
+}
+
+/**
+ * Push a value onto the symbolic stack
+ * @param seg The segment
+ * @param id The value id
+ */
+void ir_push(IRSegment *seg, int id)
+{
+    seg->stack[++seg->sp] = id;
+}
+
+/**
+ * Find the entry value for a slot below the segment
+ * @param seg The segment
+ * @param slot Entry slot index (0 = top)
+ * @return The value id
+ */
+int ir_entry(IRSegment *seg, int slot)
+{
+    return ir_node(seg, IR_ENTRY, slot, 0, NULL, 0);
+}
+
+/**
+ * Check whether a value is a specific constant
+ */
+int ir_is_const(IRSegment *seg, int id, Cell value)
+{
+    return seg->nodes[id].kind == IR_CONST && seg->nodes[id].value == value;
+}
+
+/**
+ * Build an operation value, folding constants and simple identities
+ * @param seg The segment
+ * @param w The pure built-in word
+ * @param args Operand value ids (deepest first)
+ * @param nargs Number of operands
+ * @return The value id
+ */
+int ir_operation(IRSegment *seg, Word *w, const int *args, int nargs)
+{
+    int all_const = nargs > 0 && data_stack.sp + nargs < STACK_SIZE - 1;
+    for (int k = 0; k < nargs; k++)
+    {
+        if (seg->nodes[args[k]].kind != IR_CONST)
+        {
+            all_const = 0;
+        }
+    }
+
+    // Constant folding: run the built-in on the real stack above the current contents
+    if (all_const)
+    {
+        for (int k = 0; k < nargs; k++)
+        {
+            stack_push(seg->nodes[args[k]].value);
+        }
+        w->func();
+        return ir_node(seg, IR_CONST, stack_pop(), 0, NULL, 0);
+    }
+
+    // Algebraic identities
+    if (nargs == 2)
+    {
+        if ((w->func == plus || w->func == minus || w->func == or_op) && ir_is_const(seg, args[1], 0))
+            return args[0];
+        if ((w->func == plus || w->func == or_op) && ir_is_const(seg, args[0], 0))
+            return args[1];
+        if ((w->func == star || w->func == slash) && ir_is_const(seg, args[1], 1))
+            return args[0];
+        if (w->func == star && ir_is_const(seg, args[0], 1))
+            return args[1];
+        if (w->func == and_op && ir_is_const(seg, args[1], -1))
+            return args[0];
+        if (w->func == and_op && ir_is_const(seg, args[0], -1))
+            return args[1];
+    }
+    return ir_node(seg, IR_OP, 0, (Cell)w, args, nargs);
+}
+
+/**
+ * Execute one instruction symbolically
+ * @param seg The segment being lifted
+ * @param insn The instruction
+ * @return 1 if the instruction was modelled, 0 if it is a barrier (segment unchanged)
+ */
+int ir_sym_exec(IRSegment *seg, const Insn *insn)
+{
+    int in[8];
+    Cell op = insn->op;
+
+    // Leave headroom for the values one instruction can create
+    if (seg->count + 16 > IR_MAX_NODES || seg->sp + 16 >= STACK_SIZE)
+    {
+        return 0;
+    }
+
+    if (op == OP_LIT)
+    {
+        ir_push(seg, ir_node(seg, IR_CONST, insn->arg[0], 0, NULL, 0));
+    }
+    else if (op == OP_RGET)
+    {
+        ir_push(seg, ir_node(seg, IR_REG, insn->arg[0], 0, NULL, 0));
+    }
+    else if (op == OP_PICK)
+    {
+        int n = (int)insn->arg[0];
+        if (n < 0 || n > 6)
+            return 0;
+        for (int k = n; k >= 0; k--)
+            in[k] = ir_pop(seg);
+        for (int k = 0; k <= n; k++)
+            ir_push(seg, in[k]);
+        ir_push(seg, in[0]);
+    }
+    else if (op == OP_SLIDE)
+    {
+        int r = (int)insn->arg[0];
+        int n = (int)insn->arg[1];
+        if (r < 0 || n < 0 || r + n > 8)
+            return 0;
+        for (int k = 0; k < r + n; k++)
+            in[k] = ir_pop(seg);
+        for (int k = n - 1; k >= 0; k--)
+            ir_push(seg, in[k]);
+    }
+    else if (op <= OP_SHL && op >= OP_MODK)
+    {
+        // Strength-reduced forms are lifted back to the generic word on a constant
+        int by_pow2 = op == OP_SHL || op == OP_DIVP2 || op == OP_MODP2;
+        Word *w = dict_find_builtin(op == OP_SHL ? star : (op == OP_DIVP2 || op == OP_DIVK) ? slash : mod);
+        if (!w)
+            return 0;
+        in[0] = ir_pop(seg);
+        in[1] = ir_node(seg, IR_CONST, by_pow2 ? (Cell)1 << insn->arg[0] : magic_divisors[insn->arg[0]].divisor, 0,
+                        NULL, 0);
+        ir_push(seg, ir_operation(seg, w, in, 2));
+    }
+    else if (is_word_pointer(op) && (((Word *)op)->func == pick_word || ((Word *)op)->func == roll_word))
+    {
+        // PICK and ROLL with a constant depth are shuffles, lowered to OP_PICK and OP_SLIDE
+        if (seg->sp < 0 || seg->nodes[seg->stack[seg->sp]].kind != IR_CONST)
+            return 0;
+        Cell n = seg->nodes[seg->stack[seg->sp]].value;
+        if (n < 0 || n > 6)
+            return 0;
+        ir_pop(seg);
+        for (int k = (int)n; k >= 0; k--)
+            in[k] = ir_pop(seg);
+        int roll = ((Word *)op)->func == roll_word;
+        for (int k = roll; k <= n; k++)
+            ir_push(seg, in[k]);
+        ir_push(seg, in[0]);
+    }
+    else if (is_word_pointer(op) && ((Word *)op)->func)
+    {
+        Word *w = (Word *)op;
+        int modelled = 0;
+
+        for (int s = 0; s < SHUFFLE_OP_COUNT && !modelled; s++)
+        {
+            const ShuffleOp *shuffle = &shuffle_ops[s];
+            if (shuffle->func != w->func)
+                continue;
+            for (int k = shuffle->nin - 1; k >= 0; k--)
+                in[k] = ir_pop(seg);
+            for (int k = 0; k < shuffle->nout; k++)
+                ir_push(seg, in[shuffle->out[k]]);
+            modelled = 1;
+        }
+
+        for (int p = 0; p < PURE_OP_COUNT && !modelled; p++)
+        {
+            const PureOp *pure = &pure_ops[p];
+            if (pure->func != w->func)
+                continue;
+            // Division is only pure when the divisor is a known constant other than 0 and -1
+            // (LLONG_MIN / -1 traps as well, so folding it would kill the compiler)
+            if (pure->divides && (seg->sp < 0 || seg->nodes[seg->stack[seg->sp]].kind != IR_CONST ||
+                                  seg->nodes[seg->stack[seg->sp]].value == 0 ||
+                                  seg->nodes[seg->stack[seg->sp]].value == -1))
+                return 0;
+            for (int k = pure->nargs - 1; k >= 0; k--)
+                in[k] = ir_pop(seg);
+            ir_push(seg, ir_operation(seg, w, in, pure->nargs));
+            modelled = 1;
+        }
+
+        if (!modelled)
+            return 0;
+    }
+    else
+    {
+        return 0;
+    }
+
+    seg->cost++;
+    return 1;
+}
+
+/**
+ * Append a cell to lowered code
+ */
+void ir_put(IREmitter *em, Cell cell)
+{
+    if (em->size >= em->cap)
+    {
+        em->failed = 1;
+        return;
+    }
+    em->code[em->size++] = cell;
+}
+
+/**
+ * Append an instruction with an OP_LIT-marked operand (OP_PICK, OP_RGET, OP_RSET)
+ */
+void ir_put_arg(IREmitter *em, Cell op, Cell arg)
+{
+    ir_put(em, op);
+    ir_put(em, OP_LIT);
+    ir_put(em, arg);
+    em->cost++;
+}
+
+/**
+ * Append the code that pushes a single value without modelling the stack
+ */
+void ir_put_leaf(IREmitter *em, IRNode *node, int reg)
+{
+    if (reg >= 0)
+    {
+        ir_put_arg(em, OP_RGET, reg);
+    }
+    else if (node->kind == IR_REG)
+    {
+        ir_put_arg(em, OP_RGET, node->value);
+    }
+    else
+    {
+        ir_put(em, OP_LIT);
+        ir_put(em, node->value);
+        em->cost++;
+    }
+}
+
+/**
+ * Push an item onto the modelled stack
+ */
+void lower_push(int node, IRRole role)
+{
+    lower_items[++lower_top].node = node;
+    lower_items[lower_top].role = role;
+}
+
+/**
+ * Find the topmost modelled item holding a value
+ * @return Item index, or -1 if the value is not on the modelled stack
+ */
+int lower_find(int node)
+{
+    for (int k = lower_top; k >= 0; k--)
+    {
+        if (lower_items[k].node == node)
+            return k;
+    }
+    return -1;
+}
+
+/**
+ * Count references to a value from the operands of an operation still to be emitted
+ * Nested operations that are not computed yet are counted once each
+ */
+int lower_refs(IRSegment *seg, int parent, int from, int value)
+{
+    IRNode *node = &seg->nodes[parent];
+    int refs = 0;
+    for (int k = from; k < node->nargs; k++)
+    {
+        int arg = node->args[k];
+        if (arg == value)
+        {
+            refs++;
+        }
+        else if (seg->nodes[arg].kind == IR_OP && lower_reg[arg] < 0 && lower_mark[arg] != lower_stamp &&
+                 lower_find(arg) < 0)
+        {
+            lower_mark[arg] = lower_stamp;
+            refs += lower_refs(seg, arg, 0, value);
+        }
+    }
+    return refs;
+}
+
+/**
+ * Check whether every remaining use of a value happens while emitting an operation's operands
+ * (so the value can be consumed in place instead of copied)
+ */
+int lower_local(IRSegment *seg, int value, int parent, int from)
+{
+    if (parent < 0)
+        return lower_uses[value] == 1;
+    lower_stamp++;
+    return lower_uses[value] == lower_refs(seg, parent, from, value);
+}
+
+/**
+ * Count the references to each value reachable from a use
+ */
+void lower_count(IRSegment *seg, int id)
+{
+    lower_uses[id]++;
+    if (lower_uses[id] > 1 || lower_reg[id] >= 0 || seg->nodes[id].kind != IR_OP)
+        return;
+    for (int k = 0; k < seg->nodes[id].nargs; k++)
+        lower_count(seg, seg->nodes[id].args[k]);
+}
+
+/**
+ * Emit code that leaves a value on top of the stack
+ * @param seg The segment
+ * @param em Output buffer
+ * @param id The value
+ * @param role Role of the produced item
+ * @param parent Operation the value is an operand of (-1 for segment outputs)
+ * @param argi Operand index within parent
+ */
+void lower_value(IRSegment *seg, IREmitter *em, int id, IRRole role, int parent, int argi)
+{
+    IRNode *node = &seg->nodes[id];
+    if (em->failed)
+        return;
+
+    // Constants and values held in frame slots are pushed directly
+    if (lower_reg[id] >= 0 || node->kind == IR_CONST || node->kind == IR_REG)
+    {
+        ir_put_leaf(em, node, lower_reg[id]);
+        lower_push(id, role);
+        lower_uses[id]--;
+        return;
+    }
+
+    // Values already on the stack are used in place when possible, otherwise copied
+    int pos = lower_find(id);
+    if (pos >= 0)
+    {
+        if (pos == lower_top && lower_items[pos].role == ROLE_ENTRY && lower_local(seg, id, parent, argi))
+        {
+            lower_items[pos].role = role;
+        }
+        else
+        {
+            ir_put_arg(em, OP_PICK, lower_top - pos);
+            lower_push(id, role);
+        }
+        lower_uses[id]--;
+        return;
+    }
+    if (node->kind != IR_OP)
+    {
+        em->failed = 1;
+        return;
+    }
+
+    // Leading operands already on top of the stack in order are consumed in place
+    int claimed = 0;
+    for (int s = node->nargs; s > 0 && !claimed; s--)
+    {
+        int ok = lower_top + 1 >= s;
+        for (int k = 0; k < s && ok; k++)
+        {
+            IRItem *item = &lower_items[lower_top - s + 1 + k];
+            ok = item->role == ROLE_ENTRY && item->node == node->args[k] && lower_local(seg, node->args[k], id, k);
+        }
+        if (ok)
+            claimed = s;
+    }
+    for (int k = 0; k < claimed; k++)
+    {
+        lower_items[lower_top - claimed + 1 + k].role = ROLE_TEMP;
+        lower_uses[node->args[k]]--;
+    }
+    for (int k = claimed; k < node->nargs; k++)
+    {
+        lower_value(seg, em, node->args[k], ROLE_TEMP, id, k);
+    }
+    if (em->failed)
+        return;
+
+    ir_put(em, node->op);
+    em->cost++;
+    lower_top -= node->nargs;
+    lower_push(id, role);
+    lower_uses[id]--;
+
+    // Values needed after their consumer runs are kept in a frame slot
+    if (lower_uses[id] > 0 && role != ROLE_OUT && !lower_local(seg, id, parent, argi + 1))
+    {
+        lower_reg[id] = lower_next_reg++;
+        if (lower_next_reg > lower_max_reg)
+            lower_max_reg = lower_next_reg;
+        ir_put_arg(em, OP_RSET, lower_reg[id]);
+        ir_put_arg(em, OP_RGET, lower_reg[id]);
+    }
+}
+
+/**
+ * Lower a lifted segment back to threaded code
+ * @param seg The segment (its symbolic stack holds the outputs)
+ * @param em Output buffer
+ * @param reg_base First frame slot available for temporaries
+ * @return 1 on success, 0 if the segment could not be lowered
+ */
+int ir_lower(IRSegment *seg, IREmitter *em, int reg_base)
+{
+    int n = seg->sp + 1;
+    int d = seg->depth;
+    int *outs = seg->stack;
+
+    // Entry slots at the bottom that the segment leaves untouched
+    int kept = 0;
+    while (kept < n && kept < d && seg->nodes[outs[kept]].kind == IR_ENTRY &&
+           seg->nodes[outs[kept]].value == d - 1 - kept)
+    {
+        kept++;
+    }
+
+    lower_top = -1;
+    for (int k = 0; k < d; k++)
+    {
+        lower_push(ir_entry(seg, d - 1 - k), k < kept ? ROLE_KEPT : ROLE_ENTRY);
+    }
+    for (int k = 0; k < seg->count; k++)
+    {
+        lower_uses[k] = 0;
+        lower_reg[k] = seg->nodes[k].reg;
+        lower_mark[k] = 0;
+    }
+    lower_stamp = 0;
+    lower_next_reg = reg_base;
+    for (int k = kept; k < n; k++)
+    {
+        lower_count(seg, outs[k]);
+    }
+
+    // Outputs that are already the topmost entry slots in order stay where they are
+    int in_place = 0;
+    for (int s = n - kept; s > 0 && !in_place; s--)
+    {
+        int ok = lower_top + 1 >= s;
+        for (int k = 0; k < s && ok; k++)
+        {
+            IRItem *item = &lower_items[lower_top - s + 1 + k];
+            ok = item->role == ROLE_ENTRY && item->node == outs[kept + k] && lower_uses[outs[kept + k]] == 1;
+        }
+        if (ok)
+            in_place = s;
+    }
+    for (int k = 0; k < in_place; k++)
+    {
+        lower_items[lower_top - in_place + 1 + k].role = ROLE_OUT;
+        lower_uses[outs[kept + k]]--;
+    }
+
+    for (int k = kept + in_place; k < n; k++)
+    {
+        lower_value(seg, em, outs[k], ROLE_OUT, -1, 0);
+    }
+    if (em->failed)
+        return 0;
+
+    // Everything between the kept slots and the outputs must be leftover entries
+    int first_out = lower_top - (n - kept) + 1;
+    if (first_out < kept)
+        return 0;
+    for (int k = kept; k < first_out; k++)
+    {
+        if (lower_items[k].role != ROLE_ENTRY)
+            return 0;
+    }
+    for (int k = first_out; k <= lower_top; k++)
+    {
+        if (lower_items[k].role != ROLE_OUT || lower_items[k].node != outs[kept + k - first_out])
+            return 0;
+    }
+    if (first_out > kept)
+    {
+        ir_put(em, OP_SLIDE);
+        ir_put(em, OP_LIT);
+        ir_put(em, first_out - kept);
+        ir_put(em, OP_LIT);
+        ir_put(em, n - kept);
+        em->cost++;
+    }
+    return !em->failed;
+}
+
+/**
+ * Copy instructions of the original code to the output, recording branch fixups
+ * @param code Original code
+ * @param em Output buffer
+ * @param from First instruction index
+ * @param to One past the last instruction index
+ * @param back 1 if a branch among them is the back edge of a hoisted loop
+ */
+void opt_copy(const Cell *code, IREmitter *em, int from, int to, int back)
+{
+    for (int k = from; k < to; k++)
+    {
+        Insn *insn = &opt_insns[k];
+        if (is_branch_op(insn->op))
+        {
+            opt_fix_at[opt_fix_count] = em->size + 2;
+            opt_fix_target[opt_fix_count] = insn->target;
+            opt_fix_back[opt_fix_count] = (char)back;
+            opt_fix_count++;
+        }
+        for (int c = 0; c < insn->len; c++)
+        {
+            ir_put(em, code[insn->pos + c]);
+        }
+    }
+}
+
+/**
+ * Lower a segment if that is cheaper, otherwise copy its original instructions
+ */
+void opt_flush(const Cell *code, IREmitter *em, IRSegment *seg, int from, int to)
+{
+    if (from >= to)
+        return;
+
+    IREmitter trial = {opt_tmp, 0, STACK_SIZE, 0, 0};
+    int saved_max = lower_max_reg;
+    if (ir_lower(seg, &trial, opt_next_reg) && trial.cost < seg->cost)
+    {
+        for (int k = 0; k < trial.size; k++)
+            ir_put(em, opt_tmp[k]);
+    }
+    else
+    {
+        lower_max_reg = saved_max;
+        opt_copy(code, em, from, to, 0);
+    }
+}
+
+/**
+ * Emit code computing a hoisted value before its loop
+ * @param seg The loop body segment
+ * @param em Output buffer
+ * @param id The value
+ * @param depth Cells between the top of the stack and the loop's entry slots
+ * @param done Values already stored in their frame slot
+ */
+void licm_value(IRSegment *seg, IREmitter *em, int id, int depth, const char *done)
+{
+    IRNode *node = &seg->nodes[id];
+    if (node->kind == IR_ENTRY)
+    {
+        ir_put_arg(em, OP_PICK, node->value + depth);
+    }
+    else if (node->kind != IR_OP || done[id])
+    {
+        ir_put_leaf(em, node, done[id] ? node->reg : -1);
+    }
+    else
+    {
+        for (int k = 0; k < node->nargs; k++)
+            licm_value(seg, em, node->args[k], depth + k, done);
+        ir_put(em, node->op);
+        em->cost++;
+    }
+}
+
+/**
+ * Mark loop-invariant values used by variant ones for hoisting
+ */
+void licm_select(IRSegment *seg, int id, const char *inv, char *hoist, char *seen)
+{
+    if (seen[id])
+        return;
+    seen[id] = 1;
+    IRNode *node = &seg->nodes[id];
+    if (inv[id])
+    {
+        if (node->kind == IR_OP)
+            hoist[id] = 1;
+        return;
+    }
+    if (node->kind != IR_OP)
+        return;
+    for (int k = 0; k < node->nargs; k++)
+        licm_select(seg, node->args[k], inv, hoist, seen);
+}
+
+/**
+ * Loop-invariant code motion for a single-block loop body
+ * Lifts the body, hoists invariant operations into frame slots computed by a preheader,
+ * and lowers the body using those slots. Nothing is emitted unless the body gets cheaper.
+ * @param code Original code
+ * @param from First body instruction
+ * @param to Index of the closing OP_LOOP or OP_0BRANCH
+ * @param is_do 1 for DO/LOOP bodies, 0 for BEGIN/UNTIL bodies
+ * @param pre Receives the preheader code
+ * @param body Receives the lowered body (without the closing branch)
+ * @return 1 if the loop was transformed, 0 otherwise
+ */
+int licm_loop(IRSegment *seg, int from, int to, int is_do, IREmitter *pre, IREmitter *body)
+{
+    char inv[IR_MAX_NODES];
+    char hoist[IR_MAX_NODES];
+    char seen[IR_MAX_NODES];
+
+    ir_reset(seg);
+    for (int k = from; k < to; k++)
+    {
+        if (!ir_sym_exec(seg, &opt_insns[k]))
+            return 0;
+    }
+
+    // The body must leave the stack shape unchanged (UNTIL also consumes a flag)
+    int n = seg->sp + 1 - (is_do ? 0 : 1);
+    int d = seg->depth;
+    if (n != d || d == 0)
+        return 0;
+
+    // Invariant values: entry slots passed through unchanged, constants, and pure
+    // operations on invariants (loop indices vary in DO loops)
+    memset(hoist, 0, seg->count);
+    memset(seen, 0, seg->count);
+    for (int k = 0; k < seg->count; k++)
+    {
+        IRNode *node = &seg->nodes[k];
+        if (node->kind == IR_ENTRY)
+            inv[k] = node->value < d && seg->stack[d - 1 - node->value] == k;
+        else if (node->kind == IR_OP)
+        {
+            inv[k] = node->nargs > 0;
+            for (int a = 0; a < node->nargs; a++)
+                inv[k] = inv[k] && inv[node->args[a]];
+        }
+        else
+            inv[k] = 1;
+    }
+    int hoisted = 0;
+    for (int k = 0; k <= seg->sp; k++)
+    {
+        if (!(seg->nodes[seg->stack[k]].kind == IR_ENTRY && inv[seg->stack[k]]))
+            licm_select(seg, seg->stack[k], inv, hoist, seen);
+    }
+    for (int k = 0; k < seg->count; k++)
+        hoisted += hoist[k];
+    if (!hoisted)
+        return 0;
+
+    // Cost of the body without hoisting, as opt_flush would produce it
+    int saved_max = lower_max_reg;
+    IREmitter plain = {opt_tmp, 0, STACK_SIZE, 0, 0};
+    int base_cost = seg->cost;
+    if (ir_lower(seg, &plain, opt_next_reg) && plain.cost < base_cost)
+        base_cost = plain.cost;
+
+    // Assign frame slots to hoisted values and lower the body again
+    int reg = opt_next_reg;
+    for (int k = 0; k < seg->count; k++)
+    {
+        if (hoist[k])
+            seg->nodes[k].reg = reg++;
+    }
+    lower_max_reg = saved_max;
+    if (!ir_lower(seg, body, reg) || body->cost >= base_cost)
+    {
+        for (int k = 0; k < seg->count; k++)
+            seg->nodes[k].reg = -1;
+        lower_max_reg = saved_max;
+        return 0;
+    }
+
+    // Preheader: compute each hoisted value once and store it in its frame slot
+    char done[IR_MAX_NODES];
+    memset(done, 0, seg->count);
+    for (int k = 0; k < seg->count; k++)
+    {
+        if (!hoist[k])
+            continue;
+        licm_value(seg, pre, k, is_do ? 2 : 0, done);
+        ir_put_arg(pre, OP_RSET, seg->nodes[k].reg);
+        done[k] = 1;
+    }
+    if (pre->failed)
+    {
+        lower_max_reg = saved_max;
+        return 0;
+    }
+    opt_next_reg = reg;
+    if (lower_max_reg < reg)
+        lower_max_reg = reg;
+    return 1;
+}
+
+/**
+ * Check whether a block is a single-block loop body closed by a back edge to its start
+ * @return OP_LOOP or OP_0BRANCH if it is, 0 otherwise
+ */
+int opt_loop_kind(int from, int to)
+{
+    Insn *last = &opt_insns[to - 1];
+    if (to - 1 <= from || last->target != from)
+        return 0;
+    if ((last->op == OP_LOOP || last->op == OP_LOOPK) && from > 0 && opt_insns[from - 1].op == OP_DO)
+        return OP_LOOP;
+    if (last->op == OP_0BRANCH)
+        return OP_0BRANCH;
+    return 0;
+}
+
+/**
+ * Decode a code array into opt_insns, resolve branch targets and mark basic block leaders
+ * @param code The code array
+ * @param size Number of cells in use
+ * @return Number of instructions, or -1 if the code cannot be analysed
+ */
+int opt_decode(const Cell *code, int size)
+{
+    int count = 0;
+
+    for (int pos = 0; pos <= size; pos++)
+        opt_index[pos] = -1;
+    for (int pos = 0; pos < size; count++)
+    {
+        if (pos + insn_length(code[pos]) > size)
+            return -1;
+        opt_index[pos] = count;
+        pos += insn_decode(code, pos, &opt_insns[count]);
+    }
+    opt_index[size] = count;
+    memset(opt_leader, 0, count + 1);
+    opt_leader[0] = 1;
+    for (int k = 0; k < count; k++)
+    {
+        Insn *insn = &opt_insns[k];
+        if (is_branch_op(insn->op))
+        {
+            int target = insn->pos + 2 + (int)insn->arg[0];
+            if (target < 0 || target > size || opt_index[target] < 0)
+                return -1;
+            insn->target = opt_index[target];
+            opt_leader[insn->target] = 1;
+        }
+        if (is_branch_op(insn->op) || insn->op == OP_DO)
+            opt_leader[k + 1] = 1;
+    }
+    return count;
+}
+
+/**
+ * Optimize a compiled code array in place
+ * @param code The code array (at most STACK_SIZE cells)
+ * @param size Number of cells in use
+ * @param frame_size In: frame slots already used by the word; out: frame slots required
+ * @return New number of cells (the code is left untouched if it cannot be analysed)
+ */
+int optimize_code(Cell *code, int size, int *frame_size)
+{
+    // Decode instructions and resolve branch targets to instruction indices
+    int count = opt_decode(code, size);
+    if (count < 0)
+        return size;
+
+    IREmitter em = {opt_out, 0, STACK_SIZE, 0, 0};
+    IRSegment *seg = &ir_segment;
+    opt_fix_count = 0;
+    opt_next_reg = *frame_size;
+    lower_max_reg = *frame_size;
+    opt_body_block = -1;
+
+    for (int from = 0; from < count;)
+    {
+        int to = from + 1;
+        while (to < count && !opt_leader[to])
+            to++;
+        opt_entry_pos[from] = em.size;
+        opt_back_pos[from] = em.size;
+
+        int loop = opt_loop_kind(from, to);
+        if (loop == OP_LOOP && opt_body_block == from)
+        {
+            // Body lowered when its OP_DO was emitted
+            for (int k = 0; k < opt_body_size; k++)
+                ir_put(&em, opt_body[k]);
+            opt_copy(code, &em, to - 1, to, 0);
+            opt_body_block = -1;
+            from = to;
+            continue;
+        }
+        if (loop == OP_0BRANCH)
+        {
+            IREmitter pre = {opt_tmp, 0, STACK_SIZE, 0, 0};
+            IREmitter body = {opt_body, 0, STACK_SIZE, 0, 0};
+            if (licm_loop(&ir_loop_segment, from, to - 1, 0, &pre, &body))
+            {
+                for (int k = 0; k < pre.size; k++)
+                    ir_put(&em, opt_tmp[k]);
+                opt_back_pos[from] = em.size;
+                for (int k = 0; k < body.size; k++)
+                    ir_put(&em, opt_body[k]);
+                opt_copy(code, &em, to - 1, to, 1);
+                from = to;
+                continue;
+            }
+        }
+
+        // Generic block: lift maximal runs of modelled instructions
+        int start = from;
+        ir_reset(seg);
+        for (int k = from; k < to; k++)
+        {
+            if (ir_sym_exec(seg, &opt_insns[k]))
+                continue;
+            opt_flush(code, &em, seg, start, k);
+
+            // Hoisted code of a following DO loop body goes right before OP_DO
+            if (opt_insns[k].op == OP_DO && k + 1 < count)
+            {
+                int body_to = k + 2;
+                while (body_to < count && !opt_leader[body_to])
+                    body_to++;
+                IREmitter pre = {opt_tmp, 0, STACK_SIZE, 0, 0};
+                IREmitter body = {opt_body, 0, STACK_SIZE, 0, 0};
+                if (opt_loop_kind(k + 1, body_to) == OP_LOOP &&
+                    licm_loop(&ir_loop_segment, k + 1, body_to - 1, 1, &pre, &body))
+                {
+                    for (int c = 0; c < pre.size; c++)
+                        ir_put(&em, opt_tmp[c]);
+                    opt_body_size = body.size;
+                    opt_body_block = k + 1;
+                }
+            }
+            opt_copy(code, &em, k, k + 1, 0);
+            start = k + 1;
+            ir_reset(seg);
+        }
+        opt_flush(code, &em, seg, start, to);
+        from = to;
+    }
+    opt_entry_pos[count] = em.size;
+
+    if (em.failed)
+        return size;
+
+    // Patch branch offsets (relative to the offset cell) to the new block positions
+    for (int k = 0; k < opt_fix_count; k++)
+    {
+        int target = opt_fix_back[k] ? opt_back_pos[opt_fix_target[k]] : opt_entry_pos[opt_fix_target[k]];
+        opt_out[opt_fix_at[k]] = target - opt_fix_at[k];
+    }
+
+    memcpy(code, opt_out, em.size * sizeof(Cell));
+    if (lower_max_reg > *frame_size)
+        *frame_size = lower_max_reg;
+    return em.size;
+}
+
+// Partial evaluation - Calls to pure words whose arguments are literals run at compile time
+//
+// A call preceded by a run of literals in the same basic block is evaluated on those
+// literals; if it finishes without touching anything but them, the literals and the call
+// are replaced by literals holding the resulting stack. Pure built-ins are folded the same
+// way, so chains of small words over constants collapse to a single literal.
+
+Cell pe_rstack[STACK_SIZE];            // Loop limits and indices during evaluation
+int pe_rsp = -1;                       // Top of pe_rstack
+Cell pe_frame[STACK_SIZE];             // Frame slots of the words being evaluated
+int pe_frame_sp = 0;                   // Next free frame slot
+long pe_budget = 0;                    // Instructions left for the current evaluation
+int pe_base = -1;                      // Data stack depth below the evaluation's arguments
+
+/**
+ * Check whether a built-in only rearranges or combines data stack cells
+ */
+int pe_pure_builtin(void (*func)())
+{
+    for (int k = 0; k < PURE_OP_COUNT; k++)
+    {
+        if (pure_ops[k].func == func)
+            return 1;
+    }
+    for (int k = 0; k < SHUFFLE_OP_COUNT; k++)
+    {
+        if (shuffle_ops[k].func == func)
+            return 1;
+    }
+    return func == question_dup || func == pick_word || func == roll_word;
+}
+
+/**
+ * Number of data stack cells available to the evaluation
+ */
+int pe_depth(void)
+{
+    return data_stack.sp - pe_base;
+}
+
+/**
+ * Run a pure built-in on the evaluation stack
+ * @return 1 on success, 0 if it would fail or reach below the arguments
+ */
+int pe_builtin(void (*func)())
+{
+    if (data_stack.sp + 8 >= STACK_SIZE)
+        return 0;
+
+    // Loop indices come from loops started during the evaluation only
+    if (func == i_word || func == j_word)
+    {
+        int n = func == i_word ? 0 : 2;
+        if (pe_rsp < n)
+            return 0;
+        stack_push(pe_rstack[pe_rsp - n]);
+        return 1;
+    }
+
+    // ?DUP, PICK and ROLL reach as deep as their top cell says
+    if (func == question_dup || func == pick_word || func == roll_word)
+    {
+        if (pe_depth() < 1 || (func != question_dup && (stack_peek() < 0 || pe_depth() < stack_peek() + 2)))
+            return 0;
+        func();
+        return 1;
+    }
+    for (int k = 0; k < PURE_OP_COUNT; k++)
+    {
+        if (pure_ops[k].func != func)
+            continue;
+        // Leave division by 0 or -1 (LLONG_MIN / -1 traps) to run time
+        if (pe_depth() < pure_ops[k].nargs || (pure_ops[k].divides && (stack_peek() == 0 || stack_peek() == -1)))
+            return 0;
+        func();
+        return 1;
+    }
+    for (int k = 0; k < SHUFFLE_OP_COUNT; k++)
+    {
+        if (shuffle_ops[k].func != func)
+            continue;
+        if (pe_depth() < shuffle_ops[k].nin)
+            return 0;
+        func();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Evaluate a pure word on the data stack above pe_base
+ * @param w The word
+ * @param level Nesting depth of user-defined words
+ * @return 1 on success, 0 if the word cannot be evaluated at compile time
+ */
+int pe_run(Word *w, int level)
+{
+    if (w->func)
+        return pe_builtin(w->func);
+    if (!w->pure || level > PE_MAX_LEVEL || pe_frame_sp + w->frame_size > STACK_SIZE)
+        return 0;
+
+    int frame_base = pe_frame_sp;
+    int rbase = pe_rsp;
+    int ok = 1;
+    pe_frame_sp += w->frame_size;
+
+    for (int pc = 0; pc < w->code_size && ok;)
+    {
+        Insn insn;
+        int next = pc + insn_decode(w->code, pc, &insn);
+        Cell op = insn.op;
+
+        if (--pe_budget < 0 || data_stack.sp + 8 >= STACK_SIZE)
+        {
+            ok = 0;
+        }
+        else if (op == OP_LIT)
+        {
+            stack_push(insn.arg[0]);
+        }
+        else if (op == OP_BRANCH)
+        {
+            next = pc + 2 + (int)insn.arg[0];
+        }
+        else if (op == OP_0BRANCH)
+        {
+            if (pe_depth() < 1)
+                ok = 0;
+            else if (stack_pop() == 0)
+                next = pc + 2 + (int)insn.arg[0];
+        }
+        else if (op == OP_DO)
+        {
+            if (pe_depth() < 2 || pe_rsp + 2 >= STACK_SIZE)
+            {
+                ok = 0;
+            }
+            else
+            {
+                Cell start = stack_pop();
+                pe_rstack[++pe_rsp] = stack_pop();
+                pe_rstack[++pe_rsp] = start;
+            }
+        }
+        else if (op == OP_LOOP || op == OP_LOOPK)
+        {
+            if (pe_rsp < rbase + 2)
+            {
+                ok = 0;
+            }
+            else if ((pe_rstack[pe_rsp] += op == OP_LOOPK ? insn.arg[1] : 1) < pe_rstack[pe_rsp - 1])
+            {
+                next = pc + 2 + (int)insn.arg[0];
+            }
+            else
+            {
+                pe_rsp -= 2;
+            }
+        }
+        else if (op == OP_JTAB || op == OP_BSEARCH)
+        {
+            if (pe_depth() < 1)
+            {
+                ok = 0;
+            }
+            else
+            {
+                Cell entry = case_dispatch(op, stack_peek(), insn.arg[1], insn.arg[2]);
+                next = entry < 0 ? pc + 2 + (int)insn.arg[0] : pc + 7 + 3 * (int)entry;
+            }
+        }
+        else if (op == OP_PICK)
+        {
+            if (insn.arg[0] < 0 || pe_depth() <= insn.arg[0])
+                ok = 0;
+            else
+                stack_pick(insn.arg[0]);
+        }
+        else if (op == OP_SLIDE)
+        {
+            if (insn.arg[0] < 0 || insn.arg[1] < 0 || pe_depth() < insn.arg[0] + insn.arg[1])
+                ok = 0;
+            else
+                stack_slide(insn.arg[0], insn.arg[1]);
+        }
+        else if (op == OP_RGET)
+        {
+            stack_push(pe_frame[frame_base + insn.arg[0]]);
+        }
+        else if (op == OP_RSET)
+        {
+            if (pe_depth() < 1)
+                ok = 0;
+            else
+                pe_frame[frame_base + insn.arg[0]] = stack_pop();
+        }
+        else if (op <= OP_SHL && op >= OP_MODK)
+        {
+            if (pe_depth() < 1)
+                ok = 0;
+            else
+                stack_push(apply_reduced(op, stack_pop(), insn.arg[0]));
+        }
+        else if (is_word_pointer(op))
+        {
+            ok = pe_run((Word *)op, level + 1);
+        }
+        else
+        {
+            ok = 0;
+        }
+        pc = next;
+    }
+
+    pe_frame_sp = frame_base;
+    pe_rsp = rbase;
+    return ok;
+}
+
+/**
+ * Check whether code only reads and writes the data stack (no I/O, memory or side effects)
+ * @param code The code array
+ * @param size Number of cells in use
+ * @return 1 if every instruction and every called word is pure
+ */
+int code_is_pure(const Cell *code, int size)
+{
+    for (int pos = 0; pos < size;)
+    {
+        Insn insn;
+        if (pos + insn_length(code[pos]) > size)
+            return 0;
+        pos += insn_decode(code, pos, &insn);
+        if (is_word_pointer(insn.op))
+        {
+            Word *w = (Word *)insn.op;
+            if (w->func ? !pe_pure_builtin(w->func) : !w->pure)
+                return 0;
+        }
+        else if (insn.op != OP_LIT && !is_branch_op(insn.op) && insn.op != OP_DO && insn.op != OP_PICK &&
+                 insn.op != OP_SLIDE && insn.op != OP_RGET && insn.op != OP_RSET &&
+                 !(insn.op <= OP_SHL && insn.op >= OP_MODK))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check whether code calls a built-in word
+ * @param code The code array
+ * @param size Number of cells in use
+ * @param func The built-in word's function
+ * @return 1 if some instruction calls it (or the code cannot be decoded)
+ */
+int code_calls(const Cell *code, int size, void (*func)())
+{
+    for (int pos = 0; pos < size;)
+    {
+        Insn insn;
+        if (pos + insn_length(code[pos]) > size)
+            return 1;
+        pos += insn_decode(code, pos, &insn);
+        if (is_word_pointer(insn.op) && ((Word *)insn.op)->func == func)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Replace calls to pure words on literal arguments by their results
+ * @param code The code array (at most STACK_SIZE cells)
+ * @param size Number of cells in use
+ * @return New number of cells (the code is left untouched if it cannot be analysed)
+ */
+int partial_eval(Cell *code, int size)
+{
+    int count = opt_decode(code, size);
+    if (count < 0)
+        return size;
+
+    IREmitter em = {opt_out, 0, STACK_SIZE, 0, 0};
+    int lits = 0; // Literals ending the emitted code, all in the current block
+    opt_fix_count = 0;
+
+    for (int k = 0; k < count; k++)
+    {
+        Insn *insn = &opt_insns[k];
+        opt_entry_pos[k] = em.size;
+        if (opt_leader[k])
+            lits = 0;
+
+        Word *w = is_word_pointer(insn->op) ? (Word *)insn->op : NULL;
+        if (w && (w->func ? pe_pure_builtin(w->func) : w->pure) && data_stack.sp + lits + 8 < STACK_SIZE)
+        {
+            // Evaluate above the interpreter's current stack contents
+            pe_base = data_stack.sp;
+            pe_budget = PE_BUDGET;
+            pe_rsp = -1;
+            pe_frame_sp = 0;
+            for (int c = lits; c > 0; c--)
+                stack_push(opt_out[em.size - 2 * c + 1]);
+            int ok = pe_run(w, 0);
+            int results = data_stack.sp - pe_base;
+            if (ok && em.size + 2 * (results - lits) <= em.cap)
+            {
+                em.size -= 2 * lits;
+                for (int c = 0; c < results; c++)
+                {
+                    ir_put(&em, OP_LIT);
+                    ir_put(&em, data_stack.stack[pe_base + 1 + c]);
+                }
+                data_stack.sp = pe_base;
+                lits = results;
+                continue;
+            }
+            data_stack.sp = pe_base;
+        }
+
+        opt_copy(code, &em, k, k + 1, 0);
+        lits = insn->op == OP_LIT ? lits + 1 : 0;
+    }
+    opt_entry_pos[count] = em.size;
+
+    if (em.failed)
+        return size;
+    for (int k = 0; k < opt_fix_count; k++)
+        opt_out[opt_fix_at[k]] = opt_entry_pos[opt_fix_target[k]] - opt_fix_at[k];
+    memcpy(code, opt_out, em.size * sizeof(Cell));
+    return em.size;
+}
+
+// Loop unrolling - DO loops with literal bounds and a straight-line body
+//
+// "limit start DO body LOOP" has a known trip count. Short loops are replaced by one copy of
+// the body per iteration with I turned into a literal; longer ones run UNROLL_FACTOR copies
+// per iteration (I, I 1 +, I 2 + ...) under OP_LOOPK, followed by the leftover iterations
+// unrolled completely. Runs before the optimizer so the copies get folded and shared.
+
+/**
+ * Check whether a word may read the return stack of its caller (I, J)
+ * @param w The word
+ * @param level Nesting depth of user-defined words
+ * @return 1 if it may, 0 if it certainly does not
+ */
+int word_reads_rstack(Word *w, int level)
+{
+    // Execution tokens run through EXECUTE, MAP, REDUCE and FOR-EACH, the actions of deferred
+    // words, and the code of a definition still being compiled (RECURSE) are unknown here
+    if (w->func)
+        return w->func == i_word || w->func == j_word || w->func == to_r || w->func == r_from ||
+               w->func == r_fetch || w->func == pdo_run_word || w->func == execute_xt_word || w->func == map_word ||
+               w->func == reduce_word || w->func == for_each_word;
+    if (level > PE_MAX_LEVEL || w->code_field == CODE_DEFER || (w->code_field == CODE_COLON && !w->code))
+        return 1;
+    for (int pos = 0; pos < w->code_size;)
+    {
+        Insn insn;
+        pos += insn_decode(w->code, pos, &insn);
+        if (is_word_pointer(insn.op) && word_reads_rstack((Word *)insn.op, level + 1))
+            return 1;
+        if (insn.op <= OP_MAP && insn.op >= OP_FOR_EACH && word_reads_rstack((Word *)insn.arg[0], level + 1))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Emit one copy of a loop body with its references to I and J rewritten
+ * @param code Original code
+ * @param em Output
+ * @param from First body instruction
+ * @param to Index of the closing OP_LOOP
+ * @param in_loop 1 if the copy still runs inside the (partially unrolled) loop
+ * @param index Literal value of I (in_loop = 0) or offset added to I (in_loop = 1)
+ */
+void unroll_copy(const Cell *code, IREmitter *em, int from, int to, int in_loop, Cell index)
+{
+    Word *w_i = dict_find_builtin(i_word);
+    Word *w_plus = dict_find_builtin(plus);
+
+    for (int k = from; k < to; k++)
+    {
+        Insn *insn = &opt_insns[k];
+        Word *w = is_word_pointer(insn->op) ? (Word *)insn->op : NULL;
+        if (w && w->func == i_word && !in_loop)
+        {
+            ir_put(em, OP_LIT);
+            ir_put(em, index);
+        }
+        else if (w && w->func == i_word && index != 0)
+        {
+            ir_put(em, (Cell)w_i);
+            ir_put(em, OP_LIT);
+            ir_put(em, index);
+            ir_put(em, (Cell)w_plus);
+        }
+        else if (w && w->func == j_word && !in_loop)
+        {
+            // Without its own loop frame the outer index is on top of the return stack
+            ir_put(em, (Cell)w_i);
+        }
+        else
+        {
+            opt_copy(code, em, k, k + 1, 0);
+        }
+    }
+}
+
+/**
+ * Unroll a DO loop starting at instruction k if it qualifies
+ * @param code Original code
+ * @param em Output
+ * @param k Index of the limit literal
+ * @param count Number of instructions
+ * @return Index of the closing OP_LOOP if the loop was emitted, -1 otherwise
+ */
+int unroll_loop(const Cell *code, IREmitter *em, int k, int count)
+{
+    if (k + 3 >= count || opt_insns[k].op != OP_LIT || opt_insns[k].len != 2 || opt_insns[k + 1].op != OP_LIT ||
+        opt_insns[k + 1].len != 2 || opt_insns[k + 2].op != OP_DO || opt_leader[k + 1] || opt_leader[k + 2])
+        return -1;
+
+    // The body must be one block closed by its own LOOP, without anything else using the return stack
+    int from = k + 3, to = from;
+    int cells = 0, refs = 0;
+    for (; to < count && opt_insns[to].op != OP_LOOP; to++)
+    {
+        Insn *insn = &opt_insns[to];
+        if (is_branch_op(insn->op) || insn->op == OP_DO || (to > from && opt_leader[to]))
+            return -1;
+        if (is_word_pointer(insn->op))
+        {
+            Word *w = (Word *)insn->op;
+            if (w->func == i_word || w->func == j_word)
+                refs++;
+            else if (word_reads_rstack(w, 0))
+                return -1;
+        }
+        else if (insn->op <= OP_MAP && insn->op >= OP_FOR_EACH && word_reads_rstack((Word *)insn->arg[0], 0))
+        {
+            return -1;
+        }
+        cells += insn->len;
+    }
+    if (to >= count || opt_insns[to].target != from)
+        return -1;
+
+    Cell limit = opt_insns[k].arg[0];
+    Cell start = opt_insns[k + 1].arg[0];
+    if (limit > ((Cell)1 << 62) || limit < -((Cell)1 << 62) || start > ((Cell)1 << 62) || start < -((Cell)1 << 62))
+        return -1;
+    Cell trips = limit > start ? limit - start : 1; // The body always runs at least once
+
+    if (trips <= UNROLL_FULL_TRIPS && trips * (cells + refs) <= UNROLL_MAX_CELLS)
+    {
+        for (Cell t = 0; t < trips; t++)
+            unroll_copy(code, em, from, to, 0, start + t);
+        return to;
+    }
+    if (trips < 2 * UNROLL_FACTOR || UNROLL_FACTOR * (cells + 3 * refs) > UNROLL_MAX_CELLS)
+        return -1;
+
+    // Main loop over whole groups of UNROLL_FACTOR iterations, then the leftover iterations
+    Cell main_limit = start + trips / UNROLL_FACTOR * UNROLL_FACTOR;
+    ir_put(em, OP_LIT);
+    ir_put(em, main_limit);
+    ir_put(em, OP_LIT);
+    ir_put(em, start);
+    ir_put(em, OP_DO);
+    int body_pos = em->size;
+    for (int c = 0; c < UNROLL_FACTOR; c++)
+        unroll_copy(code, em, from, to, 1, c);
+    ir_put(em, OP_LOOPK);
+    ir_put(em, OP_LIT);
+    ir_put(em, body_pos - em->size);
+    ir_put(em, OP_LIT);
+    ir_put(em, UNROLL_FACTOR);
+    for (Cell t = main_limit; t < limit; t++)
+        unroll_copy(code, em, from, to, 0, t);
+    return to;
+}
+
+/**
+ * Unroll DO loops with literal bounds
+ * @param code The code array (at most STACK_SIZE cells)
+ * @param size Number of cells in use
+ * @return New number of cells (loops that would not fit are left alone)
+ */
+int unroll_loops(Cell *code, int size)
+{
+    for (int pass = 0; pass < UNROLL_PASSES; pass++)
+    {
+        int count = opt_decode(code, size);
+        if (count < 0)
+            return size;
+
+        IREmitter em = {opt_out, 0, STACK_SIZE, 0, 0};
+        int changed = 0;
+        opt_fix_count = 0;
+        for (int k = 0; k < count; k++)
+        {
+            opt_entry_pos[k] = em.size;
+            int end = unroll_loop(code, &em, k, count);
+            if (end < 0)
+            {
+                opt_copy(code, &em, k, k + 1, 0);
+                continue;
+            }
+
+            // Nothing outside the loop branches into it
+            for (int c = k + 1; c <= end; c++)
+                opt_entry_pos[c] = em.size;
+            k = end;
+            changed = 1;
+        }
+        opt_entry_pos[count] = em.size;
+
+        if (em.failed || !changed)
+            return size;
+        for (int k = 0; k < opt_fix_count; k++)
+            opt_out[opt_fix_at[k]] = opt_entry_pos[opt_fix_target[k]] - opt_fix_at[k];
+        memcpy(code, opt_out, em.size * sizeof(Cell));
+        size = em.size;
+    }
+    return size;
+}
+
+// Quotation fusion - EXECUTE, MAP, REDUCE and FOR-EACH applied to a literal quotation
+//
+// "[: body ;] EXECUTE" becomes the body itself (or a direct call when the body needs frame
+// slots or is large). "[: body ;] MAP" becomes OP_MAP with the quotation as its operand: the
+// loop over the range runs natively and calls the body directly, with no EXECUTE dispatch or
+// execution token check per element. REDUCE and FOR-EACH become OP_REDUCE and OP_FOR_EACH.
+
+/**
+ * Find a compiled quotation by its execution token
+ * @param xt The cell to look up
+ * @return The quotation, or NULL if xt is not one
+ */
+Word *quotation_find(Cell xt)
+{
+    for (Word *quot = quotations; quot; quot = quot->next)
+    {
+        if ((Cell)quot == xt)
+            return quot;
+    }
+    return NULL;
+}
+
+/**
+ * Inline literal quotations passed to EXECUTE, MAP, REDUCE and FOR-EACH
+ * @param code The code array (at most STACK_SIZE cells)
+ * @param size Number of cells in use
+ * @return New number of cells (the code is left untouched if it cannot be analysed)
+ */
+int fuse_quotations(Cell *code, int size)
 {
-    char word_name[MAX_WORD_LEN];
+    if (!quotations)
+        return size;
+    int count = opt_decode(code, size);
+    if (count < 0)
+        return size;
 
-    // Read the next token as the word name
-    if (!tokenize(word_name))
-    {
-        error("Expected word name after :\"");
-        return;
-    }
+    IREmitter em = {opt_out, 0, STACK_SIZE, 0, 0};
+    opt_fix_count = 0;
 
-    // Check if word already exists
-    if (dict_find(word_name))
+    for (int k = 0; k < count; k++)
     {
-        error("Word already exists");
-        return;
-    }
+        Insn *insn = &opt_insns[k];
+        opt_entry_pos[k] = em.size;
 
-    // Create new word
-    Word *new_word = malloc(sizeof(Word));
-    if (!new_word)
-    {
-        error("Memory allocation failed");
-        return;
+        Word *quot = insn->op == OP_LIT ? quotation_find(insn->arg[0]) : NULL;
+        Word *w = NULL;
+        if (quot && k + 1 < count && !opt_leader[k + 1] && is_word_pointer(opt_insns[k + 1].op))
+            w = (Word *)opt_insns[k + 1].op;
+
+        if (w && w->func == execute_xt_word)
+        {
+            opt_entry_pos[++k] = em.size;
+            if (quot->frame_size > 0 || quot->code_size > FUSE_MAX_CELLS)
+            {
+                ir_put(&em, (Cell)quot);
+                continue;
+            }
+            for (int c = 0; c < quot->code_size; c++)
+                ir_put(&em, quot->code[c]);
+            continue;
+        }
+        if (w && (w->func == map_word || w->func == reduce_word || w->func == for_each_word))
+        {
+            opt_entry_pos[++k] = em.size;
+            ir_put(&em, w->func == map_word ? OP_MAP : w->func == reduce_word ? OP_REDUCE : OP_FOR_EACH);
+            ir_put(&em, OP_LIT);
+            ir_put(&em, (Cell)quot);
+            continue;
+        }
+        opt_copy(code, &em, k, k + 1, 0);
     }
+    opt_entry_pos[count] = em.size;
+
+    if (em.failed)
+        return size;
+    for (int k = 0; k < opt_fix_count; k++)
+        opt_out[opt_fix_at[k]] = opt_entry_pos[opt_fix_target[k]] - opt_fix_at[k];
+    memcpy(code, opt_out, em.size * sizeof(Cell));
+    return em.size;
+}
 
-    strcpy(new_word->name, word_name);
-    new_word->func = NULL;
-    new_word->code = malloc(STACK_SIZE * sizeof(Cell));
-    if (!new_word->code)
+/**
+ * Rewrite literal right operands of *, / and mod into strength-reduced opcodes
+ * "OP_LIT c word" and "OP_X OP_LIT arg" are both three cells, so the code is patched in place
+ * @param code The code array
+ * @param size Number of cells in use
+ * @return Number of cells (unchanged)
+ */
+int reduce_code(Cell *code, int size)
+{
+    int count = opt_decode(code, size);
+    for (int k = 1; k < count; k++)
     {
-        free(new_word);
-        error("Memory allocation failed");
-        return;
+        Insn *lit = &opt_insns[k - 1];
+        Insn *insn = &opt_insns[k];
+        Cell arg;
+        if (opt_leader[k] || lit->op != OP_LIT || lit->len != 2 || !is_word_pointer(insn->op) ||
+            !((Word *)insn->op)->func)
+            continue;
+        Cell reduced = strength_reduce(((Word *)insn->op)->func, lit->arg[0], &arg);
+        if (!reduced)
+            continue;
+        code[lit->pos] = reduced;
+        code[lit->pos + 1] = OP_LIT;
+        code[lit->pos + 2] = arg;
     }
-    new_word->code_size = 0;
-    new_word->next = NULL;
-
-    // Set current word and switch to compile mode
-    current_word = new_word;
-    state = 1;
-    code_sp = 0; // Reset code buffer pointer
+    return size;
 }
 
-void semicolon(void)
+// Register VM backend - Lua-style three-address code generated from the optimized threaded code
+//
+// Each straight-line segment is lifted to SSA with the optimizer's symbolic executor; every
+// value that reaches the segment's outputs gets a register in the call frame. Operands are
+// read from the data stack in place (GETS) and only the segment's net effect is written back
+// (DROP + PUSH), so shuffles disappear and binary operators become single instructions with
+// register or constant operands. Anything that is not modelled stays a stack operation
+// (CALL, PICK, SLIDE, DO, LOOP), which keeps both backends observably identical.
+
+// Pure built-ins with a dedicated register opcode
+const RegBinary reg_binary_ops[] = {
+    {plus, RV_ADD},          {minus, RV_SUB},         {star, RV_MUL},
+    {slash, RV_DIV},         {mod, RV_MOD},           {equal, RV_EQ},
+    {less_than, RV_LT},      {greater_than, RV_GT},   {less_equal, RV_LE},
+    {greater_equal, RV_GE},  {not_equal, RV_NE},      {and_op, RV_AND},
+    {or_op, RV_OR},
+};
+#define REG_BINARY_COUNT (int)(sizeof(reg_binary_ops) / sizeof(reg_binary_ops[0]))
+
+// Translator working storage
+RegInsn reg_buffer[4 * STACK_SIZE];     // Register code being generated
+int reg_size = 0;                       // Instructions in reg_buffer
+int reg_failed = 0;                     // 1 = translation gave up
+int reg_next = 0;                       // Next free register in the current segment
+int reg_max = 0;                        // Registers needed by the word
+int reg_of[IR_MAX_NODES];               // Register holding each value (-1 = none)
+char reg_need[IR_MAX_NODES];            // 1 = value reaches an output of the segment
+int reg_block_pos[STACK_SIZE + 1];      // Register code index of each instruction index
+int reg_fix_at[STACK_SIZE];             // Jumps waiting for their target
+int reg_fix_target[STACK_SIZE];         // Instruction index each jump goes to
+int reg_fix_count = 0;
+
+/**
+ * Append a register VM instruction
+ */
+void reg_emit(int op, int a, int b, int c, Cell k)
 {
-    if (state == 0)
+    if (reg_size >= 4 * STACK_SIZE)
     {
-        error("Misplaced ;");
+        reg_failed = 1;
         return;
     }
+    RegInsn *ins = &reg_buffer[reg_size++];
+    ins->op = op;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+    ins->k = k;
+}
 
-    if (!current_word)
+/**
+ * Append a jump to an instruction index, patched once all blocks are placed
+ */
+void reg_emit_jump(int op, int a, int target)
+{
+    if (reg_fix_count >= STACK_SIZE)
     {
-        error("No word being defined");
+        reg_failed = 1;
         return;
     }
-
-    // Copy compiled code from buffer to word
-    current_word->code_size = code_sp;
-    memcpy(current_word->code, code_buffer, code_sp * sizeof(Cell));
-
-    // Add to dictionary
-    dict_add(current_word);
-
-    // Reset state
-    state = 0;
-    current_word = NULL;
-    code_sp = 0;
+    reg_fix_at[reg_fix_count] = reg_size;
+    reg_fix_target[reg_fix_count++] = target;
+    reg_emit(op, a, 0, 0, 0);
 }
 
 /**
- * BEGIN: Mark the start of a loop construct
- * Pushes current position to branch stack for UNTIL/WHILE to reference
+ * Mark a value and its operands as needed
  */
-void begin_word(void)
+void reg_mark(IRSegment *seg, int id)
 {
-    if (state) // Only works in compile mode
-    {
-        branch_stack_push(code_sp, CF_BEGIN); // Mark loop start position
-    }
-    else
+    if (reg_need[id])
+        return;
+    reg_need[id] = 1;
+    IRNode *node = &seg->nodes[id];
+    if (node->kind == IR_OP)
     {
-        error("BEGIN used outside of compilation mode");
+        for (int k = 0; k < node->nargs; k++)
+            reg_mark(seg, node->args[k]);
     }
 }
 
 /**
- * UNTIL: End a begin-until loop with conditional test
- * Compiles conditional branch back to BEGIN if top of stack is false (0)
+ * Get the register holding a value, loading constants on demand
  */
-void until_word(void)
+int reg_operand(IRSegment *seg, int id)
 {
-    if (state) // Only works in compile mode
-    {
-        if (branch_stack_empty())
-        {
-            error("UNTIL without matching BEGIN");
-            return;
-        }
-
-        BranchEntry entry = branch_stack_pop();
-        if (entry.type != CF_BEGIN)
-        {
-            error("UNTIL without matching BEGIN");
-            return;
-        }
-
-        // Compile conditional branch back to BEGIN
-        code_buffer[code_sp++] = OP_0BRANCH; // Branch if false
-        code_buffer[code_sp++] = OP_LIT;     // Literal marker
-        // Negative offset to branch backward to BEGIN
-        code_buffer[code_sp++] = (entry.origin - code_sp);
-    }
-    else
+    if (reg_of[id] < 0)
     {
-        error("UNTIL used outside of compilation mode");
+        reg_of[id] = reg_next++;
+        reg_emit(RV_LOADK, reg_of[id], 0, 0, seg->nodes[id].value);
     }
+    return reg_of[id];
 }
 
 /**
- * WHILE: Conditional test within begin-while-repeat loop
- * Compiles conditional branch to exit loop if condition is false
+ * Translate a lifted segment to register code
+ * @param seg The segment
+ * @param branch_target Instruction index of a following OP_0BRANCH target, -1 if none
  */
-void while_word(void)
+void reg_lower(IRSegment *seg, int branch_target)
 {
-    if (state) // Only works in compile mode
+    int flag = branch_target >= 0 ? ir_pop(seg) : -1;
+    int outputs = seg->sp + 1;
+
+    // Outputs still equal to the entry in the same slot stay on the stack untouched
+    int kept = 0;
+    while (kept < outputs && kept < seg->depth && seg->stack[kept] == ir_entry(seg, seg->depth - 1 - kept))
+        kept++;
+
+    memset(reg_need, 0, seg->count);
+    for (int k = 0; k < seg->count; k++)
+        reg_of[k] = -1;
+    for (int k = kept; k < outputs; k++)
+        reg_mark(seg, seg->stack[k]);
+    if (flag >= 0)
+        reg_mark(seg, flag);
+
+    // Values are created after their operands, so creation order is a valid schedule
+    reg_next = 0;
+    for (int id = 0; id < seg->count; id++)
     {
-        if (branch_stack_empty())
+        IRNode *node = &seg->nodes[id];
+        if (!reg_need[id] || node->kind == IR_CONST)
+            continue;
+        if (node->kind == IR_ENTRY || node->kind == IR_REG)
         {
-            error("WHILE without matching BEGIN");
-            return;
+            reg_of[id] = reg_next++;
+            reg_emit(node->kind == IR_ENTRY ? RV_GETS : RV_GETF, reg_of[id], 0, 0, node->value);
+            continue;
         }
 
-        BranchEntry entry = branch_stack_peek();
-        if (entry.type != CF_BEGIN)
+        Word *w = (Word *)node->op;
+        int op = -1;
+        for (int k = 0; k < REG_BINARY_COUNT && op < 0; k++)
         {
-            error("WHILE without matching BEGIN");
-            return;
+            if (reg_binary_ops[k].func == w->func && node->nargs == 2)
+                op = reg_binary_ops[k].op;
+        }
+        if (op >= 0)
+        {
+            int b = reg_operand(seg, node->args[0]);
+            IRNode *rhs = &seg->nodes[node->args[1]];
+            Cell arg = 0;
+            Cell reduced = rhs->kind == IR_CONST ? strength_reduce(w->func, rhs->value, &arg) : 0;
+            reg_of[id] = reg_next++;
+            if (reduced)
+                reg_emit(RV_SHLK + (int)(OP_SHL - reduced), reg_of[id], b, 0, arg);
+            else if (rhs->kind == IR_CONST && !((op == RV_DIV || op == RV_MOD) && rhs->value == 0))
+                reg_emit(op + RV_CONST_OFFSET, reg_of[id], b, 0, rhs->value);
+            else
+                reg_emit(op, reg_of[id], b, reg_operand(seg, node->args[1]), 0);
+        }
+        else if (w->func == not_op)
+        {
+            int b = reg_operand(seg, node->args[0]);
+            reg_of[id] = reg_next++;
+            reg_emit(RV_NOT, reg_of[id], b, 0, 0);
         }
+        else if (w->func == i_word || w->func == j_word)
+        {
+            reg_of[id] = reg_next++;
+            reg_emit(w->func == i_word ? RV_I : RV_J, reg_of[id], 0, 0, 0);
+        }
+        else if (node->nargs <= 2)
+        {
+            int b = node->nargs > 0 ? reg_operand(seg, node->args[0]) : -1;
+            int c = node->nargs > 1 ? reg_operand(seg, node->args[1]) : -1;
+            reg_of[id] = reg_next++;
+            reg_emit(RV_APPLY, reg_of[id], b, c, node->op);
+        }
+        else
+        {
+            reg_failed = 1;
+        }
+    }
 
-        // Compile conditional exit branch (like IF)
-        branch_stack_push(code_sp, CF_WHILE);
-        code_buffer[code_sp++] = OP_0BRANCH; // Branch if false
-        code_buffer[code_sp++] = OP_LIT;     // Literal marker
-        code_buffer[code_sp++] = 0;          // Placeholder for exit offset
+    // Write back the segment's net stack effect
+    if (seg->depth > kept)
+        reg_emit(RV_DROP, 0, 0, 0, seg->depth - kept);
+    for (int k = kept; k < outputs; k++)
+    {
+        IRNode *node = &seg->nodes[seg->stack[k]];
+        if (node->kind == IR_CONST)
+            reg_emit(RV_PUSHK, 0, 0, 0, node->value);
+        else
+            reg_emit(RV_PUSH, reg_of[seg->stack[k]], 0, 0, 0);
     }
-    else
+
+    // Conditional branch on the flag register (constant flags resolve statically)
+    if (flag >= 0)
     {
-        error("WHILE used outside of compilation mode");
+        if (seg->nodes[flag].kind != IR_CONST)
+            reg_emit_jump(RV_JMPZ, reg_of[flag], branch_target);
+        else if (seg->nodes[flag].value == 0)
+            reg_emit_jump(RV_JMP, 0, branch_target);
     }
+    if (reg_next > reg_max)
+        reg_max = reg_next;
 }
 
 /**
- * REPEAT: Complete begin-while-repeat loop structure
- * Compiles unconditional branch back to BEGIN and fixes WHILE exit offset
+ * Generate a word's register VM translation from its (optimized) threaded code
+ * The word keeps rcode == NULL when the code cannot be translated
+ * @param word The user-defined word
  */
-void repeat_word(void)
+void compile_registers(Word *word)
 {
-    if (state) // Only works in compile mode
+    free(word->rcode);
+    word->rcode = NULL;
+    word->rcode_size = 0;
+    word->reg_count = 0;
+
+    int count = opt_decode(word->code, word->code_size);
+    if (count < 0)
+        return;
+
+    IRSegment *seg = &ir_segment;
+    reg_size = 0;
+    reg_failed = 0;
+    reg_max = 0;
+    reg_fix_count = 0;
+    ir_reset(seg);
+
+    for (int k = 0; k < count; k++)
     {
-        if (branch_stack_empty())
+        Insn *insn = &opt_insns[k];
+        if (opt_leader[k])
         {
-            error("REPEAT without matching BEGIN-WHILE");
-            return;
+            reg_lower(seg, -1);
+            ir_reset(seg);
+            reg_block_pos[k] = reg_size;
         }
+        if (ir_sym_exec(seg, insn))
+            continue;
 
-        BranchEntry while_entry = branch_stack_pop();
-        if (while_entry.type != CF_WHILE)
+        if (insn->op == OP_0BRANCH)
         {
-            error("REPEAT without matching WHILE");
-            return;
+            if (seg->cost == 0 && seg->count == 0)
+                reg_emit_jump(RV_JMPZS, 0, insn->target);
+            else
+                reg_lower(seg, insn->target);
+            ir_reset(seg);
+            continue;
         }
+        reg_lower(seg, -1);
+        ir_reset(seg);
 
-        if (branch_stack_empty())
+        // Retry on a fresh segment in case the previous one was full
+        if (ir_sym_exec(seg, insn))
+            continue;
+
+        if (insn->op == OP_BRANCH)
+            reg_emit_jump(RV_JMP, 0, insn->target);
+        else if (insn->op == OP_LOOP || insn->op == OP_LOOPK)
         {
-            error("REPEAT without matching BEGIN");
-            return;
+            reg_emit_jump(RV_LOOP, 0, insn->target);
+            reg_buffer[reg_size - 1].b = insn->op == OP_LOOPK ? (int)insn->arg[1] : 1;
         }
-
-        BranchEntry begin_entry = branch_stack_pop();
-        if (begin_entry.type != CF_BEGIN)
+        else if (insn->op == OP_JTAB || insn->op == OP_BSEARCH)
         {
-            error("REPEAT without matching BEGIN");
-            return;
+            reg_emit(RV_SWITCH, (int)insn->arg[2], insn->op == OP_BSEARCH, 0, insn->arg[1]);
+            reg_emit_jump(RV_JMP, 0, insn->target);
         }
+        else if (insn->op == OP_DO)
+            reg_emit(RV_DO, 0, 0, 0, 0);
+        else if (insn->op == OP_PICK)
+            reg_emit(RV_PICK, 0, 0, 0, insn->arg[0]);
+        else if (insn->op == OP_SLIDE)
+            reg_emit(RV_SLIDE, 0, (int)insn->arg[0], (int)insn->arg[1], 0);
+        else if (insn->op == OP_RSET)
+            reg_emit(RV_SETF, 0, 0, 0, insn->arg[0]);
+        else if (insn->op <= OP_MAP && insn->op >= OP_FOR_EACH)
+            reg_emit(RV_RANGE, (int)insn->op, 0, 0, insn->arg[0]);
+        else if (is_word_pointer(insn->op))
+            reg_emit(RV_CALL, 0, 0, 0, insn->op);
+        else
+            reg_failed = 1;
+    }
+    reg_lower(seg, -1);
+    reg_block_pos[count] = reg_size;
 
-        // Compile unconditional branch back to BEGIN
-        code_buffer[code_sp++] = OP_BRANCH; // Always branch
-        code_buffer[code_sp++] = OP_LIT;    // Literal marker
-        // Negative offset to branch backward to BEGIN
-        code_buffer[code_sp++] = (begin_entry.origin - code_sp);
+    if (reg_failed)
+        return;
 
-        // Fix WHILE branch to exit to current position (after loop)
-        code_buffer[while_entry.origin + 2] = code_sp - (while_entry.origin + 2);
-    }
-    else
-    {
-        error("REPEAT used outside of compilation mode");
-    }
+    for (int k = 0; k < reg_fix_count; k++)
+        reg_buffer[reg_fix_at[k]].k = reg_block_pos[reg_fix_target[k]];
+
+    word->rcode = malloc((reg_size ? reg_size : 1) * sizeof(RegInsn));
+    if (!word->rcode)
+        return;
+    memcpy(word->rcode, reg_buffer, reg_size * sizeof(RegInsn));
+    word->rcode_size = reg_size;
+    word->reg_count = reg_max;
 }
 
 /**
- * DO: Start a counted loop (limit start -- )
- * Pops start and limit from stack, pushes them to return stack for LOOP
+ * STACK-VM: Run user-defined words on the threaded stack backend (default)
  */
-void do_word(void)
+void stack_vm_word(void)
 {
-    if (state) // Only works in compile mode
-    {
-        branch_stack_push(code_sp, CF_DO); // Track loop start
-        code_buffer[code_sp++] = OP_DO;    // Compile DO opcode
-    }
-    else
-    {
-        error("DO used outside of compilation mode");
-    }
+    vm_backend = BACKEND_STACK;
 }
 
 /**
- * LOOP: End a DO loop, increment index and test against limit
- * Compiles LOOP opcode with backward branch offset to DO position
+ * REGISTER-VM: Run user-defined words on the register VM backend
  */
-void loop_word(void)
+void register_vm_word(void)
 {
-    if (state) // Only works in compile mode
-    {
-        if (branch_stack_empty())
-        {
-            error("LOOP without matching DO");
-            return;
-        }
-
-        BranchEntry entry = branch_stack_pop();
-        if (entry.type != CF_DO)
-        {
-            error("LOOP without matching DO");
-            return;
-        }
+    vm_backend = BACKEND_REGISTER;
+}
 
-        code_buffer[code_sp++] = OP_LOOP; // Compile LOOP opcode
-        code_buffer[code_sp++] = OP_LIT;  // Literal marker
-        // Backward offset to branch to instruction after DO
-        code_buffer[code_sp++] = (entry.origin + 1 - code_sp);
+/**
+ * BACKEND: ( n "name" -- ) Select the backend of one word
+ * -1 follows the global setting, 0 forces the stack backend, 1 the register backend
+ */
+void backend_word(void)
+{
+    char name[MAX_WORD_LEN];
+    Cell n = stack_pop();
+    if (!tokenize(name))
+    {
+        error("BACKEND needs a word name");
+        return;
     }
-    else
+    Word *w = dict_find(name);
+    if (!w || w->func)
     {
-        error("LOOP used outside of compilation mode");
+        error("BACKEND needs a user-defined word");
+        return;
+    }
+    if (n < BACKEND_DEFAULT || n > BACKEND_REGISTER)
+    {
+        error("Invalid backend");
+        return;
     }
+    w->backend = (int)n;
 }
 
 // Initialize the interpreter - Set up all core data structures and built-in words
@@ -1250,9 +7844,81 @@ void forth_init(void)
     w_mod->next = NULL;
     dict_add(w_mod);
 
+    Word *w_one_plus = malloc(sizeof(Word));
+    strcpy(w_one_plus->name, "1+");
+    w_one_plus->func = one_plus;
+    w_one_plus->code = NULL;
+    w_one_plus->code_size = 0;
+    w_one_plus->immediate = 0;
+    w_one_plus->next = NULL;
+    dict_add(w_one_plus);
+
+    Word *w_one_minus = malloc(sizeof(Word));
+    strcpy(w_one_minus->name, "1-");
+    w_one_minus->func = one_minus;
+    w_one_minus->code = NULL;
+    w_one_minus->code_size = 0;
+    w_one_minus->immediate = 0;
+    w_one_minus->next = NULL;
+    dict_add(w_one_minus);
+
+    Word *w_two_star = malloc(sizeof(Word));
+    strcpy(w_two_star->name, "2*");
+    w_two_star->func = two_star;
+    w_two_star->code = NULL;
+    w_two_star->code_size = 0;
+    w_two_star->immediate = 0;
+    w_two_star->next = NULL;
+    dict_add(w_two_star);
+
+    Word *w_two_slash = malloc(sizeof(Word));
+    strcpy(w_two_slash->name, "2/");
+    w_two_slash->func = two_slash;
+    w_two_slash->code = NULL;
+    w_two_slash->code_size = 0;
+    w_two_slash->immediate = 0;
+    w_two_slash->next = NULL;
+    dict_add(w_two_slash);
+
+    Word *w_negate = malloc(sizeof(Word));
+    strcpy(w_negate->name, "NEGATE");
+    w_negate->func = negate;
+    w_negate->code = NULL;
+    w_negate->code_size = 0;
+    w_negate->immediate = 0;
+    w_negate->next = NULL;
+    dict_add(w_negate);
+
+    Word *w_abs = malloc(sizeof(Word));
+    strcpy(w_abs->name, "ABS");
+    w_abs->func = abs_op;
+    w_abs->code = NULL;
+    w_abs->code_size = 0;
+    w_abs->immediate = 0;
+    w_abs->next = NULL;
+    dict_add(w_abs);
+
+    Word *w_min = malloc(sizeof(Word));
+    strcpy(w_min->name, "MIN");
+    w_min->func = min_op;
+    w_min->code = NULL;
+    w_min->code_size = 0;
+    w_min->immediate = 0;
+    w_min->next = NULL;
+    dict_add(w_min);
+
+    Word *w_max = malloc(sizeof(Word));
+    strcpy(w_max->name, "MAX");
+    w_max->func = max_op;
+    w_max->code = NULL;
+    w_max->code_size = 0;
+    w_max->immediate = 0;
+    w_max->next = NULL;
+    dict_add(w_max);
+
     Word *w_dup = malloc(sizeof(Word));
     strcpy(w_dup->name, "dup");
-    w_dup->func = dup;
+    w_dup->func = dup_op;
     w_dup->code = NULL;
     w_dup->code_size = 0;
     w_dup->immediate = 0;
@@ -1313,6 +7979,87 @@ void forth_init(void)
     w_tuck->next = NULL;
     dict_add(w_tuck);
 
+    Word *w_two_dup = malloc(sizeof(Word));
+    strcpy(w_two_dup->name, "2DUP");
+    w_two_dup->func = two_dup;
+    w_two_dup->code = NULL;
+    w_two_dup->code_size = 0;
+    w_two_dup->immediate = 0;
+    w_two_dup->next = NULL;
+    dict_add(w_two_dup);
+
+    Word *w_two_drop = malloc(sizeof(Word));
+    strcpy(w_two_drop->name, "2DROP");
+    w_two_drop->func = two_drop;
+    w_two_drop->code = NULL;
+    w_two_drop->code_size = 0;
+    w_two_drop->immediate = 0;
+    w_two_drop->next = NULL;
+    dict_add(w_two_drop);
+
+    Word *w_two_swap = malloc(sizeof(Word));
+    strcpy(w_two_swap->name, "2SWAP");
+    w_two_swap->func = two_swap;
+    w_two_swap->code = NULL;
+    w_two_swap->code_size = 0;
+    w_two_swap->immediate = 0;
+    w_two_swap->next = NULL;
+    dict_add(w_two_swap);
+
+    Word *w_two_over = malloc(sizeof(Word));
+    strcpy(w_two_over->name, "2OVER");
+    w_two_over->func = two_over;
+    w_two_over->code = NULL;
+    w_two_over->code_size = 0;
+    w_two_over->immediate = 0;
+    w_two_over->next = NULL;
+    dict_add(w_two_over);
+
+    Word *w_minus_rot = malloc(sizeof(Word));
+    strcpy(w_minus_rot->name, "-ROT");
+    w_minus_rot->func = minus_rot;
+    w_minus_rot->code = NULL;
+    w_minus_rot->code_size = 0;
+    w_minus_rot->immediate = 0;
+    w_minus_rot->next = NULL;
+    dict_add(w_minus_rot);
+
+    Word *w_question_dup = malloc(sizeof(Word));
+    strcpy(w_question_dup->name, "?DUP");
+    w_question_dup->func = question_dup;
+    w_question_dup->code = NULL;
+    w_question_dup->code_size = 0;
+    w_question_dup->immediate = 0;
+    w_question_dup->next = NULL;
+    dict_add(w_question_dup);
+
+    Word *w_pick = malloc(sizeof(Word));
+    strcpy(w_pick->name, "PICK");
+    w_pick->func = pick_word;
+    w_pick->code = NULL;
+    w_pick->code_size = 0;
+    w_pick->immediate = 0;
+    w_pick->next = NULL;
+    dict_add(w_pick);
+
+    Word *w_roll = malloc(sizeof(Word));
+    strcpy(w_roll->name, "ROLL");
+    w_roll->func = roll_word;
+    w_roll->code = NULL;
+    w_roll->code_size = 0;
+    w_roll->immediate = 0;
+    w_roll->next = NULL;
+    dict_add(w_roll);
+
+    Word *w_depth = malloc(sizeof(Word));
+    strcpy(w_depth->name, "DEPTH");
+    w_depth->func = depth_word;
+    w_depth->code = NULL;
+    w_depth->code_size = 0;
+    w_depth->immediate = 0;
+    w_depth->next = NULL;
+    dict_add(w_depth);
+
     Word *w_equal = malloc(sizeof(Word));
     strcpy(w_equal->name, "=");
     w_equal->func = equal;
@@ -1367,6 +8114,15 @@ void forth_init(void)
     w_not_eq->next = NULL;
     dict_add(w_not_eq);
 
+    Word *w_zero_equal = malloc(sizeof(Word));
+    strcpy(w_zero_equal->name, "0=");
+    w_zero_equal->func = zero_equal;
+    w_zero_equal->code = NULL;
+    w_zero_equal->code_size = 0;
+    w_zero_equal->immediate = 0;
+    w_zero_equal->next = NULL;
+    dict_add(w_zero_equal);
+
     Word *w_and = malloc(sizeof(Word));
     strcpy(w_and->name, "and");
     w_and->func = and_op;
@@ -1394,6 +8150,42 @@ void forth_init(void)
     w_not->next = NULL;
     dict_add(w_not);
 
+    Word *w_xor = malloc(sizeof(Word));
+    strcpy(w_xor->name, "XOR");
+    w_xor->func = xor_op;
+    w_xor->code = NULL;
+    w_xor->code_size = 0;
+    w_xor->immediate = 0;
+    w_xor->next = NULL;
+    dict_add(w_xor);
+
+    Word *w_invert = malloc(sizeof(Word));
+    strcpy(w_invert->name, "INVERT");
+    w_invert->func = not_op;  // Same operation as not
+    w_invert->code = NULL;
+    w_invert->code_size = 0;
+    w_invert->immediate = 0;
+    w_invert->next = NULL;
+    dict_add(w_invert);
+
+    Word *w_lshift = malloc(sizeof(Word));
+    strcpy(w_lshift->name, "LSHIFT");
+    w_lshift->func = lshift;
+    w_lshift->code = NULL;
+    w_lshift->code_size = 0;
+    w_lshift->immediate = 0;
+    w_lshift->next = NULL;
+    dict_add(w_lshift);
+
+    Word *w_rshift = malloc(sizeof(Word));
+    strcpy(w_rshift->name, "RSHIFT");
+    w_rshift->func = rshift;
+    w_rshift->code = NULL;
+    w_rshift->code_size = 0;
+    w_rshift->immediate = 0;
+    w_rshift->next = NULL;
+    dict_add(w_rshift);
+
     Word *w_store = malloc(sizeof(Word));
     strcpy(w_store->name, "!");
     w_store->func = store;
@@ -1412,6 +8204,51 @@ void forth_init(void)
     w_fetch->next = NULL;
     dict_add(w_fetch);
 
+    Word *w_atomic_fetch = malloc(sizeof(Word));
+    strcpy(w_atomic_fetch->name, "ATOMIC@");
+    w_atomic_fetch->func = atomic_fetch_word;
+    w_atomic_fetch->code = NULL;
+    w_atomic_fetch->code_size = 0;
+    w_atomic_fetch->immediate = 0;
+    w_atomic_fetch->next = NULL;
+    dict_add(w_atomic_fetch);
+
+    Word *w_atomic_store = malloc(sizeof(Word));
+    strcpy(w_atomic_store->name, "ATOMIC!");
+    w_atomic_store->func = atomic_store_word;
+    w_atomic_store->code = NULL;
+    w_atomic_store->code_size = 0;
+    w_atomic_store->immediate = 0;
+    w_atomic_store->next = NULL;
+    dict_add(w_atomic_store);
+
+    Word *w_atomic_add = malloc(sizeof(Word));
+    strcpy(w_atomic_add->name, "ATOMIC+!");
+    w_atomic_add->func = atomic_add_word;
+    w_atomic_add->code = NULL;
+    w_atomic_add->code_size = 0;
+    w_atomic_add->immediate = 0;
+    w_atomic_add->next = NULL;
+    dict_add(w_atomic_add);
+
+    Word *w_cas = malloc(sizeof(Word));
+    strcpy(w_cas->name, "CAS");
+    w_cas->func = cas_word;
+    w_cas->code = NULL;
+    w_cas->code_size = 0;
+    w_cas->immediate = 0;
+    w_cas->next = NULL;
+    dict_add(w_cas);
+
+    Word *w_fence = malloc(sizeof(Word));
+    strcpy(w_fence->name, "FENCE");
+    w_fence->func = fence_word;
+    w_fence->code = NULL;
+    w_fence->code_size = 0;
+    w_fence->immediate = 0;
+    w_fence->next = NULL;
+    dict_add(w_fence);
+
     Word *w_create = malloc(sizeof(Word));
     strcpy(w_create->name, "CREATE");
     w_create->func = create_word;
@@ -1421,6 +8258,15 @@ void forth_init(void)
     w_create->next = NULL;
     dict_add(w_create);
 
+    Word *w_does = malloc(sizeof(Word));
+    strcpy(w_does->name, "DOES>");
+    w_does->func = does_word;
+    w_does->code = NULL;
+    w_does->code_size = 0;
+    w_does->immediate = 1;  // Ends the defining part while compiling
+    w_does->next = NULL;
+    dict_add(w_does);
+
     Word *w_variable = malloc(sizeof(Word));
     strcpy(w_variable->name, "VARIABLE");
     w_variable->func = variable_word;
@@ -1473,6 +8319,15 @@ void forth_init(void)
     w_allot->next = NULL;
     dict_add(w_allot);
 
+    Word *w_comma = malloc(sizeof(Word));
+    strcpy(w_comma->name, ",");
+    w_comma->func = comma_word;
+    w_comma->code = NULL;
+    w_comma->code_size = 0;
+    w_comma->immediate = 0;
+    w_comma->next = NULL;
+    dict_add(w_comma);
+
     Word *w_i = malloc(sizeof(Word));
     strcpy(w_i->name, "i");
     w_i->func = i_word;
@@ -1491,6 +8346,33 @@ void forth_init(void)
     w_j->next = NULL;
     dict_add(w_j);
 
+    Word *w_to_r = malloc(sizeof(Word));
+    strcpy(w_to_r->name, ">R");
+    w_to_r->func = to_r;
+    w_to_r->code = NULL;
+    w_to_r->code_size = 0;
+    w_to_r->immediate = 0;
+    w_to_r->next = NULL;
+    dict_add(w_to_r);
+
+    Word *w_r_from = malloc(sizeof(Word));
+    strcpy(w_r_from->name, "R>");
+    w_r_from->func = r_from;
+    w_r_from->code = NULL;
+    w_r_from->code_size = 0;
+    w_r_from->immediate = 0;
+    w_r_from->next = NULL;
+    dict_add(w_r_from);
+
+    Word *w_r_fetch = malloc(sizeof(Word));
+    strcpy(w_r_fetch->name, "R@");
+    w_r_fetch->func = r_fetch;
+    w_r_fetch->code = NULL;
+    w_r_fetch->code_size = 0;
+    w_r_fetch->immediate = 0;
+    w_r_fetch->next = NULL;
+    dict_add(w_r_fetch);
+
     Word *w_dot_s = malloc(sizeof(Word));
     strcpy(w_dot_s->name, ".s");
     w_dot_s->func = dot_s;
@@ -1600,6 +8482,42 @@ void forth_init(void)
     w_end->next = NULL;
     dict_add(w_end);
 
+    Word *w_case = malloc(sizeof(Word));
+    strcpy(w_case->name, "case");
+    w_case->func = case_word;
+    w_case->code = NULL;
+    w_case->code_size = 0;
+    w_case->immediate = 1;
+    w_case->next = NULL;
+    dict_add(w_case);
+
+    Word *w_of = malloc(sizeof(Word));
+    strcpy(w_of->name, "of");
+    w_of->func = of_word;
+    w_of->code = NULL;
+    w_of->code_size = 0;
+    w_of->immediate = 1;
+    w_of->next = NULL;
+    dict_add(w_of);
+
+    Word *w_endof = malloc(sizeof(Word));
+    strcpy(w_endof->name, "endof");
+    w_endof->func = endof_word;
+    w_endof->code = NULL;
+    w_endof->code_size = 0;
+    w_endof->immediate = 1;
+    w_endof->next = NULL;
+    dict_add(w_endof);
+
+    Word *w_endcase = malloc(sizeof(Word));
+    strcpy(w_endcase->name, "endcase");
+    w_endcase->func = endcase_word;
+    w_endcase->code = NULL;
+    w_endcase->code_size = 0;
+    w_endcase->immediate = 1;
+    w_endcase->next = NULL;
+    dict_add(w_endcase);
+
     Word *w_colon = malloc(sizeof(Word));
     strcpy(w_colon->name, ":");
     w_colon->func = colon;
@@ -1617,6 +8535,619 @@ void forth_init(void)
     w_semicolon->immediate = 1;
     w_semicolon->next = NULL;
     dict_add(w_semicolon);
+
+    // Execution backend selection
+    Word *w_stack_vm = malloc(sizeof(Word));
+    strcpy(w_stack_vm->name, "STACK-VM");
+    w_stack_vm->func = stack_vm_word;
+    w_stack_vm->code = NULL;
+    w_stack_vm->code_size = 0;
+    w_stack_vm->immediate = 0;
+    w_stack_vm->next = NULL;
+    dict_add(w_stack_vm);
+
+    Word *w_register_vm = malloc(sizeof(Word));
+    strcpy(w_register_vm->name, "REGISTER-VM");
+    w_register_vm->func = register_vm_word;
+    w_register_vm->code = NULL;
+    w_register_vm->code_size = 0;
+    w_register_vm->immediate = 0;
+    w_register_vm->next = NULL;
+    dict_add(w_register_vm);
+
+    Word *w_backend = malloc(sizeof(Word));
+    strcpy(w_backend->name, "BACKEND");
+    w_backend->func = backend_word;
+    w_backend->code = NULL;
+    w_backend->code_size = 0;
+    w_backend->immediate = 0;
+    w_backend->next = NULL;
+    dict_add(w_backend);
+
+    Word *w_lbracket = malloc(sizeof(Word));
+    strcpy(w_lbracket->name, "[");
+    w_lbracket->func = left_bracket_word;
+    w_lbracket->code = NULL;
+    w_lbracket->code_size = 0;
+    w_lbracket->immediate = 1;
+    w_lbracket->next = NULL;
+    dict_add(w_lbracket);
+
+    Word *w_rbracket = malloc(sizeof(Word));
+    strcpy(w_rbracket->name, "]");
+    w_rbracket->func = right_bracket_word;
+    w_rbracket->code = NULL;
+    w_rbracket->code_size = 0;
+    w_rbracket->immediate = 0;
+    w_rbracket->next = NULL;
+    dict_add(w_rbracket);
+
+    Word *w_literal = malloc(sizeof(Word));
+    strcpy(w_literal->name, "LITERAL");
+    w_literal->func = literal_word;
+    w_literal->code = NULL;
+    w_literal->code_size = 0;
+    w_literal->immediate = 1;
+    w_literal->next = NULL;
+    dict_add(w_literal);
+
+    Word *w_postpone = malloc(sizeof(Word));
+    strcpy(w_postpone->name, "POSTPONE");
+    w_postpone->func = postpone_word;
+    w_postpone->code = NULL;
+    w_postpone->code_size = 0;
+    w_postpone->immediate = 1;
+    w_postpone->next = NULL;
+    dict_add(w_postpone);
+
+    Word *w_immediate = malloc(sizeof(Word));
+    strcpy(w_immediate->name, "IMMEDIATE");
+    w_immediate->func = immediate_word;
+    w_immediate->code = NULL;
+    w_immediate->code_size = 0;
+    w_immediate->immediate = 0;
+    w_immediate->next = NULL;
+    dict_add(w_immediate);
+
+    Word *w_locals = malloc(sizeof(Word));
+    strcpy(w_locals->name, "{:");
+    w_locals->func = locals_word;
+    w_locals->code = NULL;
+    w_locals->code_size = 0;
+    w_locals->immediate = 1;
+    w_locals->next = NULL;
+    dict_add(w_locals);
+
+    Word *w_to = malloc(sizeof(Word));
+    strcpy(w_to->name, "TO");
+    w_to->func = to_word;
+    w_to->code = NULL;
+    w_to->code_size = 0;
+    w_to->immediate = 1;
+    w_to->next = NULL;
+    dict_add(w_to);
+
+    Word *w_quotation = malloc(sizeof(Word));
+    strcpy(w_quotation->name, "[:");
+    w_quotation->func = quotation_word;
+    w_quotation->code = NULL;
+    w_quotation->code_size = 0;
+    w_quotation->immediate = 1;
+    w_quotation->next = NULL;
+    dict_add(w_quotation);
+
+    Word *w_end_quotation = malloc(sizeof(Word));
+    strcpy(w_end_quotation->name, ";]");
+    w_end_quotation->func = end_quotation_word;
+    w_end_quotation->code = NULL;
+    w_end_quotation->code_size = 0;
+    w_end_quotation->immediate = 1;
+    w_end_quotation->next = NULL;
+    dict_add(w_end_quotation);
+
+    Word *w_tick = malloc(sizeof(Word));
+    strcpy(w_tick->name, "'");
+    w_tick->func = tick_word;
+    w_tick->code = NULL;
+    w_tick->code_size = 0;
+    w_tick->immediate = 0;
+    w_tick->next = NULL;
+    dict_add(w_tick);
+
+    Word *w_execute = malloc(sizeof(Word));
+    strcpy(w_execute->name, "EXECUTE");
+    w_execute->func = execute_xt_word;
+    w_execute->code = NULL;
+    w_execute->code_size = 0;
+    w_execute->immediate = 0;
+    w_execute->next = NULL;
+    dict_add(w_execute);
+
+    Word *w_map = malloc(sizeof(Word));
+    strcpy(w_map->name, "MAP");
+    w_map->func = map_word;
+    w_map->code = NULL;
+    w_map->code_size = 0;
+    w_map->immediate = 0;
+    w_map->next = NULL;
+    dict_add(w_map);
+
+    Word *w_reduce = malloc(sizeof(Word));
+    strcpy(w_reduce->name, "REDUCE");
+    w_reduce->func = reduce_word;
+    w_reduce->code = NULL;
+    w_reduce->code_size = 0;
+    w_reduce->immediate = 0;
+    w_reduce->next = NULL;
+    dict_add(w_reduce);
+
+    Word *w_for_each = malloc(sizeof(Word));
+    strcpy(w_for_each->name, "FOR-EACH");
+    w_for_each->func = for_each_word;
+    w_for_each->code = NULL;
+    w_for_each->code_size = 0;
+    w_for_each->immediate = 0;
+    w_for_each->next = NULL;
+    dict_add(w_for_each);
+
+    Word *w_defer = malloc(sizeof(Word));
+    strcpy(w_defer->name, "DEFER");
+    w_defer->func = defer_word;
+    w_defer->code = NULL;
+    w_defer->code_size = 0;
+    w_defer->immediate = 0;
+    w_defer->next = NULL;
+    dict_add(w_defer);
+
+    Word *w_is = malloc(sizeof(Word));
+    strcpy(w_is->name, "IS");
+    w_is->func = is_word;
+    w_is->code = NULL;
+    w_is->code_size = 0;
+    w_is->immediate = 1;  // Compiles the assignment inside definitions
+    w_is->next = NULL;
+    dict_add(w_is);
+
+    Word *w_action_of = malloc(sizeof(Word));
+    strcpy(w_action_of->name, "ACTION-OF");
+    w_action_of->func = action_of_word;
+    w_action_of->code = NULL;
+    w_action_of->code_size = 0;
+    w_action_of->immediate = 1;  // Compiles the fetch inside definitions
+    w_action_of->next = NULL;
+    dict_add(w_action_of);
+
+    Word *w_defer_fetch = malloc(sizeof(Word));
+    strcpy(w_defer_fetch->name, "DEFER@");
+    w_defer_fetch->func = defer_fetch_word;
+    w_defer_fetch->code = NULL;
+    w_defer_fetch->code_size = 0;
+    w_defer_fetch->immediate = 0;
+    w_defer_fetch->next = NULL;
+    dict_add(w_defer_fetch);
+
+    Word *w_defer_store = malloc(sizeof(Word));
+    strcpy(w_defer_store->name, "DEFER!");
+    w_defer_store->func = defer_store_word;
+    w_defer_store->code = NULL;
+    w_defer_store->code_size = 0;
+    w_defer_store->immediate = 0;
+    w_defer_store->next = NULL;
+    dict_add(w_defer_store);
+
+    Word *w_recurse = malloc(sizeof(Word));
+    strcpy(w_recurse->name, "RECURSE");
+    w_recurse->func = recurse_word;
+    w_recurse->code = NULL;
+    w_recurse->code_size = 0;
+    w_recurse->immediate = 1;  // Compiles a call to the current definition
+    w_recurse->next = NULL;
+    dict_add(w_recurse);
+
+    Word *w_memo = malloc(sizeof(Word));
+    strcpy(w_memo->name, "MEMO:");
+    w_memo->func = memo_colon_word;
+    w_memo->code = NULL;
+    w_memo->code_size = 0;
+    w_memo->immediate = 0;
+    w_memo->next = NULL;
+    dict_add(w_memo);
+
+    Word *w_memo_capacity = malloc(sizeof(Word));
+    strcpy(w_memo_capacity->name, "MEMO-CAPACITY");
+    w_memo_capacity->func = memo_capacity_word;
+    w_memo_capacity->code = NULL;
+    w_memo_capacity->code_size = 0;
+    w_memo_capacity->immediate = 0;
+    w_memo_capacity->next = NULL;
+    dict_add(w_memo_capacity);
+
+    Word *w_memo_evict = malloc(sizeof(Word));
+    strcpy(w_memo_evict->name, "MEMO-EVICT");
+    w_memo_evict->func = memo_evict_word;
+    w_memo_evict->code = NULL;
+    w_memo_evict->code_size = 0;
+    w_memo_evict->immediate = 0;
+    w_memo_evict->next = NULL;
+    dict_add(w_memo_evict);
+
+    Word *w_memo_stats = malloc(sizeof(Word));
+    strcpy(w_memo_stats->name, "MEMO-STATS");
+    w_memo_stats->func = memo_stats_word;
+    w_memo_stats->code = NULL;
+    w_memo_stats->code_size = 0;
+    w_memo_stats->immediate = 0;
+    w_memo_stats->next = NULL;
+    dict_add(w_memo_stats);
+
+    Word *w_memo_clear = malloc(sizeof(Word));
+    strcpy(w_memo_clear->name, "MEMO-CLEAR");
+    w_memo_clear->func = memo_clear_word;
+    w_memo_clear->code = NULL;
+    w_memo_clear->code_size = 0;
+    w_memo_clear->immediate = 0;
+    w_memo_clear->next = NULL;
+    dict_add(w_memo_clear);
+
+    Word *w_task = malloc(sizeof(Word));
+    strcpy(w_task->name, "TASK");
+    w_task->func = task_word;
+    w_task->code = NULL;
+    w_task->code_size = 0;
+    w_task->immediate = 0;
+    w_task->next = NULL;
+    dict_add(w_task);
+
+    Word *w_activate = malloc(sizeof(Word));
+    strcpy(w_activate->name, "ACTIVATE");
+    w_activate->func = activate_word;
+    w_activate->code = NULL;
+    w_activate->code_size = 0;
+    w_activate->immediate = 0;
+    w_activate->next = NULL;
+    dict_add(w_activate);
+
+    Word *w_pause = malloc(sizeof(Word));
+    strcpy(w_pause->name, "PAUSE");
+    w_pause->func = pause_word;
+    w_pause->code = NULL;
+    w_pause->code_size = 0;
+    w_pause->immediate = 0;
+    w_pause->next = NULL;
+    dict_add(w_pause);
+
+    Word *w_stop = malloc(sizeof(Word));
+    strcpy(w_stop->name, "STOP");
+    w_stop->func = stop_word;
+    w_stop->code = NULL;
+    w_stop->code_size = 0;
+    w_stop->immediate = 0;
+    w_stop->next = NULL;
+    dict_add(w_stop);
+
+    Word *w_coroutine = malloc(sizeof(Word));
+    strcpy(w_coroutine->name, "COROUTINE");
+    w_coroutine->func = coroutine_word;
+    w_coroutine->code = NULL;
+    w_coroutine->code_size = 0;
+    w_coroutine->immediate = 0;
+    w_coroutine->next = NULL;
+    dict_add(w_coroutine);
+
+    Word *w_start = malloc(sizeof(Word));
+    strcpy(w_start->name, "START");
+    w_start->func = start_word;
+    w_start->code = NULL;
+    w_start->code_size = 0;
+    w_start->immediate = 0;
+    w_start->next = NULL;
+    dict_add(w_start);
+
+    Word *w_resume = malloc(sizeof(Word));
+    strcpy(w_resume->name, "RESUME");
+    w_resume->func = resume_word;
+    w_resume->code = NULL;
+    w_resume->code_size = 0;
+    w_resume->immediate = 0;
+    w_resume->next = NULL;
+    dict_add(w_resume);
+
+    Word *w_yield = malloc(sizeof(Word));
+    strcpy(w_yield->name, "YIELD");
+    w_yield->func = yield_word;
+    w_yield->code = NULL;
+    w_yield->code_size = 0;
+    w_yield->immediate = 0;
+    w_yield->next = NULL;
+    dict_add(w_yield);
+
+    Word *w_pdo = malloc(sizeof(Word));
+    strcpy(w_pdo->name, "PDO");
+    w_pdo->func = pdo_word;
+    w_pdo->code = NULL;
+    w_pdo->code_size = 0;
+    w_pdo->immediate = 1;  // Starts the loop body
+    w_pdo->next = NULL;
+    dict_add(w_pdo);
+
+    Word *w_ploop = malloc(sizeof(Word));
+    strcpy(w_ploop->name, "PLOOP");
+    w_ploop->func = ploop_word;
+    w_ploop->code = NULL;
+    w_ploop->code_size = 0;
+    w_ploop->immediate = 1;  // Compiles the parallel loop
+    w_ploop->next = NULL;
+    dict_add(w_ploop);
+
+    Word *w_ploop_sum = malloc(sizeof(Word));
+    strcpy(w_ploop_sum->name, "PLOOP-SUM");
+    w_ploop_sum->func = ploop_sum_word;
+    w_ploop_sum->code = NULL;
+    w_ploop_sum->code_size = 0;
+    w_ploop_sum->immediate = 1;  // Compiles the loop with a sum
+    w_ploop_sum->next = NULL;
+    dict_add(w_ploop_sum);
+
+    Word *w_ploop_min = malloc(sizeof(Word));
+    strcpy(w_ploop_min->name, "PLOOP-MIN");
+    w_ploop_min->func = ploop_min_word;
+    w_ploop_min->code = NULL;
+    w_ploop_min->code_size = 0;
+    w_ploop_min->immediate = 1;  // Compiles the loop with a minimum
+    w_ploop_min->next = NULL;
+    dict_add(w_ploop_min);
+
+    Word *w_ploop_max = malloc(sizeof(Word));
+    strcpy(w_ploop_max->name, "PLOOP-MAX");
+    w_ploop_max->func = ploop_max_word;
+    w_ploop_max->code = NULL;
+    w_ploop_max->code_size = 0;
+    w_ploop_max->immediate = 1;  // Compiles the loop with a maximum
+    w_ploop_max->next = NULL;
+    dict_add(w_ploop_max);
+
+    Word *w_pdo_run = malloc(sizeof(Word));
+    strcpy(w_pdo_run->name, "(PDO)");
+    w_pdo_run->func = pdo_run_word;
+    w_pdo_run->code = NULL;
+    w_pdo_run->code_size = 0;
+    w_pdo_run->immediate = 0;
+    w_pdo_run->next = NULL;
+    dict_add(w_pdo_run);
+
+    Word *w_pdo_threads = malloc(sizeof(Word));
+    strcpy(w_pdo_threads->name, "PDO-THREADS");
+    w_pdo_threads->func = pdo_threads_word;
+    w_pdo_threads->code = NULL;
+    w_pdo_threads->code_size = 0;
+    w_pdo_threads->immediate = 0;
+    w_pdo_threads->next = NULL;
+    dict_add(w_pdo_threads);
+
+    Word *w_spawn = malloc(sizeof(Word));
+    strcpy(w_spawn->name, "SPAWN");
+    w_spawn->func = spawn_word;
+    w_spawn->code = NULL;
+    w_spawn->code_size = 0;
+    w_spawn->immediate = 0;
+    w_spawn->next = NULL;
+    dict_add(w_spawn);
+
+    Word *w_sync = malloc(sizeof(Word));
+    strcpy(w_sync->name, "SYNC");
+    w_sync->func = sync_word;
+    w_sync->code = NULL;
+    w_sync->code_size = 0;
+    w_sync->immediate = 0;
+    w_sync->next = NULL;
+    dict_add(w_sync);
+
+    Word *w_channel = malloc(sizeof(Word));
+    strcpy(w_channel->name, "CHANNEL");
+    w_channel->func = channel_word;
+    w_channel->code = NULL;
+    w_channel->code_size = 0;
+    w_channel->immediate = 0;
+    w_channel->next = NULL;
+    dict_add(w_channel);
+
+    Word *w_to_chan = malloc(sizeof(Word));
+    strcpy(w_to_chan->name, ">CHAN");
+    w_to_chan->func = to_chan_word;
+    w_to_chan->code = NULL;
+    w_to_chan->code_size = 0;
+    w_to_chan->immediate = 0;
+    w_to_chan->next = NULL;
+    dict_add(w_to_chan);
+
+    Word *w_from_chan = malloc(sizeof(Word));
+    strcpy(w_from_chan->name, "CHAN>");
+    w_from_chan->func = from_chan_word;
+    w_from_chan->code = NULL;
+    w_from_chan->code_size = 0;
+    w_from_chan->immediate = 0;
+    w_from_chan->next = NULL;
+    dict_add(w_from_chan);
+
+    Word *w_try_from_chan = malloc(sizeof(Word));
+    strcpy(w_try_from_chan->name, "?CHAN>");
+    w_try_from_chan->func = try_from_chan_word;
+    w_try_from_chan->code = NULL;
+    w_try_from_chan->code_size = 0;
+    w_try_from_chan->immediate = 0;
+    w_try_from_chan->next = NULL;
+    dict_add(w_try_from_chan);
+
+    Word *w_to_chan_n = malloc(sizeof(Word));
+    strcpy(w_to_chan_n->name, ">CHAN-N");
+    w_to_chan_n->func = to_chan_n_word;
+    w_to_chan_n->code = NULL;
+    w_to_chan_n->code_size = 0;
+    w_to_chan_n->immediate = 0;
+    w_to_chan_n->next = NULL;
+    dict_add(w_to_chan_n);
+
+    Word *w_from_chan_n = malloc(sizeof(Word));
+    strcpy(w_from_chan_n->name, "CHAN-N>");
+    w_from_chan_n->func = from_chan_n_word;
+    w_from_chan_n->code = NULL;
+    w_from_chan_n->code_size = 0;
+    w_from_chan_n->immediate = 0;
+    w_from_chan_n->next = NULL;
+    dict_add(w_from_chan_n);
+
+    Word *w_read_fd = malloc(sizeof(Word));
+    strcpy(w_read_fd->name, "READ-FD");
+    w_read_fd->func = read_fd_word;
+    w_read_fd->code = NULL;
+    w_read_fd->code_size = 0;
+    w_read_fd->immediate = 0;
+    w_read_fd->next = NULL;
+    dict_add(w_read_fd);
+
+    Word *w_write_fd = malloc(sizeof(Word));
+    strcpy(w_write_fd->name, "WRITE-FD");
+    w_write_fd->func = write_fd_word;
+    w_write_fd->code = NULL;
+    w_write_fd->code_size = 0;
+    w_write_fd->immediate = 0;
+    w_write_fd->next = NULL;
+    dict_add(w_write_fd);
+
+    Word *w_wait_readable = malloc(sizeof(Word));
+    strcpy(w_wait_readable->name, "WAIT-READABLE");
+    w_wait_readable->func = wait_readable_word;
+    w_wait_readable->code = NULL;
+    w_wait_readable->code_size = 0;
+    w_wait_readable->immediate = 0;
+    w_wait_readable->next = NULL;
+    dict_add(w_wait_readable);
+
+    Word *w_ms = malloc(sizeof(Word));
+    strcpy(w_ms->name, "MS");
+    w_ms->func = ms_word;
+    w_ms->code = NULL;
+    w_ms->code_size = 0;
+    w_ms->immediate = 0;
+    w_ms->next = NULL;
+    dict_add(w_ms);
+
+    Word *w_after = malloc(sizeof(Word));
+    strcpy(w_after->name, "AFTER");
+    w_after->func = after_word;
+    w_after->code = NULL;
+    w_after->code_size = 0;
+    w_after->immediate = 0;
+    w_after->next = NULL;
+    dict_add(w_after);
+
+    Word *w_pipe = malloc(sizeof(Word));
+    strcpy(w_pipe->name, "PIPE");
+    w_pipe->func = pipe_word;
+    w_pipe->code = NULL;
+    w_pipe->code_size = 0;
+    w_pipe->immediate = 0;
+    w_pipe->next = NULL;
+    dict_add(w_pipe);
+
+    Word *w_close_fd = malloc(sizeof(Word));
+    strcpy(w_close_fd->name, "CLOSE-FD");
+    w_close_fd->func = close_fd_word;
+    w_close_fd->code = NULL;
+    w_close_fd->code_size = 0;
+    w_close_fd->immediate = 0;
+    w_close_fd->next = NULL;
+    dict_add(w_close_fd);
+
+    Word *w_open_file = malloc(sizeof(Word));
+    strcpy(w_open_file->name, "OPEN-FILE");
+    w_open_file->func = open_file_word;
+    w_open_file->code = NULL;
+    w_open_file->code_size = 0;
+    w_open_file->immediate = 0;
+    w_open_file->next = NULL;
+    dict_add(w_open_file);
+
+    Word *w_uring_read = malloc(sizeof(Word));
+    strcpy(w_uring_read->name, "URING-READ");
+    w_uring_read->func = uring_read_word;
+    w_uring_read->code = NULL;
+    w_uring_read->code_size = 0;
+    w_uring_read->immediate = 0;
+    w_uring_read->next = NULL;
+    dict_add(w_uring_read);
+
+    Word *w_uring_write = malloc(sizeof(Word));
+    strcpy(w_uring_write->name, "URING-WRITE");
+    w_uring_write->func = uring_write_word;
+    w_uring_write->code = NULL;
+    w_uring_write->code_size = 0;
+    w_uring_write->immediate = 0;
+    w_uring_write->next = NULL;
+    dict_add(w_uring_write);
+
+    Word *w_uring_submit = malloc(sizeof(Word));
+    strcpy(w_uring_submit->name, "URING-SUBMIT");
+    w_uring_submit->func = uring_submit_word;
+    w_uring_submit->code = NULL;
+    w_uring_submit->code_size = 0;
+    w_uring_submit->immediate = 0;
+    w_uring_submit->next = NULL;
+    dict_add(w_uring_submit);
+
+    Word *w_uring_poll = malloc(sizeof(Word));
+    strcpy(w_uring_poll->name, "URING-POLL");
+    w_uring_poll->func = uring_poll_word;
+    w_uring_poll->code = NULL;
+    w_uring_poll->code_size = 0;
+    w_uring_poll->immediate = 0;
+    w_uring_poll->next = NULL;
+    dict_add(w_uring_poll);
+
+    Word *w_uring_wait = malloc(sizeof(Word));
+    strcpy(w_uring_wait->name, "URING-WAIT");
+    w_uring_wait->func = uring_wait_word;
+    w_uring_wait->code = NULL;
+    w_uring_wait->code_size = 0;
+    w_uring_wait->immediate = 0;
+    w_uring_wait->next = NULL;
+    dict_add(w_uring_wait);
+
+    Word *w_byte_fetch = malloc(sizeof(Word));
+    strcpy(w_byte_fetch->name, "BYTE@");
+    w_byte_fetch->func = byte_fetch_word;
+    w_byte_fetch->code = NULL;
+    w_byte_fetch->code_size = 0;
+    w_byte_fetch->immediate = 0;
+    w_byte_fetch->next = NULL;
+    dict_add(w_byte_fetch);
+
+    Word *w_byte_store = malloc(sizeof(Word));
+    strcpy(w_byte_store->name, "BYTE!");
+    w_byte_store->func = byte_store_word;
+    w_byte_store->code = NULL;
+    w_byte_store->code_size = 0;
+    w_byte_store->immediate = 0;
+    w_byte_store->next = NULL;
+    dict_add(w_byte_store);
+
+    Word *w_time_slice = malloc(sizeof(Word));
+    strcpy(w_time_slice->name, "TIME-SLICE");
+    w_time_slice->func = time_slice_word;
+    w_time_slice->code = NULL;
+    w_time_slice->code_size = 0;
+    w_time_slice->immediate = 0;
+    w_time_slice->next = NULL;
+    dict_add(w_time_slice);
+
+    Word *w_step_limit = malloc(sizeof(Word));
+    strcpy(w_step_limit->name, "STEP-LIMIT");
+    w_step_limit->func = step_limit_word;
+    w_step_limit->code = NULL;
+    w_step_limit->code_size = 0;
+    w_step_limit->immediate = 0;
+    w_step_limit->next = NULL;
+    dict_add(w_step_limit);
 }
 
 // Simple tokenizer - Parse input text into individual words and tokens
@@ -1704,25 +9235,25 @@ void repl(void)
         {
             if (state == 1) // Compile mode - building user-defined words
             {
-                Word *word = dict_find(token);
-                if (word)
+                // Locals shadow dictionary words
+                int slot = local_find(token);
+                Word *word = slot < 0 ? dict_find(token) : NULL;
+                if (slot >= 0)
+                {
+                    if (!compile_local(OP_RGET, slot))
+                        break;
+                }
+                else if (word)
                 {
                     if (word->immediate)
                     {
                         // Execute immediate words (like control flow) during compilation
                         execute_word(word);
                     }
-                    else
+                    else if (!compile_word(word))
                     {
-                        // Compile word reference into code buffer
-                        if (code_sp >= STACK_SIZE)
-                        {
-                            error("Code buffer overflow");
-                            state = 0;  // Reset to interpret mode
-                            current_word = NULL;
-                            break;
-                        }
-                        code_buffer[code_sp++] = (Cell)word;
+                        // Code buffer overflow (error already reset the interpreter)
+                        break;
                     }
                 }
                 else
@@ -1758,7 +9289,10 @@ void repl(void)
                 if (word)
                 {
                     // Execute the found word
+                    step_begin();
                     execute_word(word);
+                    if (step_aborted)
+                        break; // STEP-LIMIT drops the rest of the line
                 }
                 else
                 {
@@ -1786,11 +9320,37 @@ void repl(void)
  * Program entry point
  * Initialize the Forth interpreter and start the REPL
  */
-int main(void)
+int main(int argc, char **argv)
 {
+    const char *profile_path = NULL;
+
     forth_init();  // Set up interpreter with built-in words
+
+    // Command line options - profile-guided code layout
+    for (int k = 1; k < argc; k++)
+    {
+        if (strcmp(argv[k], "--pgo-profile") == 0 && k + 1 < argc)
+        {
+            profile_path = argv[++k];
+        }
+        else if (strcmp(argv[k], "--pgo-use") == 0 && k + 1 < argc)
+        {
+            if (!pgo_load(argv[++k]))
+                fprintf(stderr, "Cannot read profile %s\n", argv[k]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--pgo-profile file] [--pgo-use file]\n", argv[0]);
+            return 1;
+        }
+    }
+    pgo_profiling = profile_path != NULL;
+
     repl();        // Start Read-Eval-Print Loop
 
+    if (profile_path && !pgo_save(profile_path))
+        fprintf(stderr, "Cannot write profile %s\n", profile_path);
+
     // Clean up allocated memory (optional, but good practice)
     for (int i = 0; i < dict.count; i++)
     {
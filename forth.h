@@ -1,10 +1,26 @@
 #ifndef FORTH_H
 #define FORTH_H
 
+#define _GNU_SOURCE  // ucontext, pthreads, epoll and sched_getaffinity under -std=c99
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
 
 // Core system constants - Define memory and buffer sizes for the Forth interpreter
 #define STACK_SIZE 1024    // Size of data stack, return stack, and branch stack
@@ -22,6 +38,137 @@ typedef struct
     int sp;                  // Stack pointer (-1 = empty, 0+ = valid indices)
 } Stack;
 
+// Register VM opcodes - Lua-style three-address instructions over a frame of virtual registers
+typedef enum
+{
+    RV_LOADK,   // R[a] = k
+    RV_GETS,    // R[a] = data stack item k below the top
+    RV_GETF,    // R[a] = frame slot k
+    RV_SETF,    // frame slot k = pop()
+    RV_PUSH,    // push R[a]
+    RV_PUSHK,   // push k
+    RV_DROP,    // discard k data stack items
+    RV_ADD,     // R[a] = R[b] + R[c]  (RV_ADD .. RV_OR: register operands)
+    RV_SUB,
+    RV_MUL,
+    RV_DIV,
+    RV_MOD,
+    RV_EQ,
+    RV_LT,
+    RV_GT,
+    RV_LE,
+    RV_GE,
+    RV_NE,
+    RV_AND,
+    RV_OR,
+    RV_ADDK,    // R[a] = R[b] + k  (RV_ADDK .. RV_ORK: constant right operand, same order)
+    RV_SUBK,
+    RV_MULK,
+    RV_DIVK,
+    RV_MODK,
+    RV_EQK,
+    RV_LTK,
+    RV_GTK,
+    RV_LEK,
+    RV_GEK,
+    RV_NEK,
+    RV_ANDK,
+    RV_ORK,
+    RV_SHLK,    // R[a] = R[b] << k  (strength-reduced multiply)
+    RV_DIVP2,   // R[a] = R[b] / 2^k, rounding toward zero
+    RV_MODP2,   // R[a] = R[b] mod 2^k
+    RV_DIVM,    // R[a] = R[b] / d with magic_divisors[k]
+    RV_MODM,    // R[a] = R[b] mod d with magic_divisors[k]
+    RV_NOT,     // R[a] = ~R[b]
+    RV_I,       // R[a] = current loop index
+    RV_J,       // R[a] = outer loop index
+    RV_APPLY,   // R[a] = pure word k applied to R[b], R[c] (-1 = unused operand)
+    RV_CALL,    // execute word k on the data stack
+    RV_PICK,    // push a copy of data stack item k below the top
+    RV_SLIDE,   // remove b data stack items below the top c
+    RV_JMP,     // pc = k
+    RV_JMPZ,    // if R[a] == 0: pc = k
+    RV_JMPZS,   // if pop() == 0: pc = k
+    RV_SWITCH,  // b = 0: table from k, b = 1: search case_keys[k]; pc = matching entry of the a RV_JMP
+                // entries after the default RV_JMP, or fall through to the default
+    RV_DO,      // move limit and start from the data stack to the return stack
+    RV_LOOP,    // add b to the loop index, pc = k while index < limit
+    RV_RANGE    // run OP_MAP, OP_REDUCE or OP_FOR_EACH (a) with word k
+} RegOp;
+
+#define RV_CONST_OFFSET (RV_ADDK - RV_ADD) // Distance from a register form to its constant form
+
+// Register VM instruction
+typedef struct
+{
+    int op;        // RegOp
+    int a, b, c;   // Register operands (a = destination)
+    Cell k;        // Constant, stack depth, frame slot, jump target or word pointer
+} RegInsn;
+
+// Execution backends for user-defined words
+#define BACKEND_DEFAULT -1   // Follow the global vm_backend setting
+#define BACKEND_STACK 0      // Threaded stack code (execute_word)
+#define BACKEND_REGISTER 1   // Register VM code (execute_registers)
+
+// Partial evaluation limits - Calls to pure words with literal arguments run at compile time
+#define PE_BUDGET 100000     // Instructions one compile-time evaluation may take
+#define PE_MAX_LEVEL 64      // Nesting depth of user-defined words during evaluation
+
+// CASE compilation - Clauses with literal selectors are dispatched by table or binary search
+#define CASE_MAX_CLAUSES 256  // OF clauses in one case-endcase
+#define CASE_MAX_NEST 16      // Nesting depth of case-endcase
+#define CASE_KEYS_MAX 4096    // Sorted selectors of all binary-search dispatches
+
+// Locals - Named frame slots of the definition being compiled
+#define LOCALS_MAX 32         // Locals in one definition
+
+// One OF clause of the case being compiled
+typedef struct
+{
+    Cell key;     // Selector value
+    int literal;  // 1 = selector is a single literal
+    int body;     // Code offset of the clause body (after the OF test)
+    int endof;    // Code offset of the ENDOF branch
+} CaseClause;
+
+// Case-endcase being compiled
+typedef struct
+{
+    int start;                             // Code offset of the first clause
+    int count;                             // Number of OF clauses
+    CaseClause clauses[CASE_MAX_CLAUSES];  // Clauses in source order
+} CaseFrame;
+
+// Code fields - How execute_word runs a user-defined word
+#define CODE_COLON 0   // Threaded code in code[]
+#define CODE_CREATE 1  // Push param without entering the threaded code
+#define CODE_DOES 2    // Push param, then run the threaded code of the shared DOES> behaviour word
+#define CODE_CONSTANT 3 // DOCON: push the constant value in param
+#define CODE_VARIABLE 4 // DOVAR: push the variable's address in param
+#define CODE_DEFER 5    // Run the word whose execution token is in param (DEFER)
+
+// Memoization - Result cache of a MEMO: word, open addressing over a small probe window
+#define MEMO_MAX_ARITY 8          // Inputs or outputs of a MEMO: word
+#define MEMO_DEFAULT_CAPACITY 1024 // Entries of a new cache
+#define MEMO_MAX_CAPACITY (1 << 20) // Largest cache
+#define MEMO_PROBE 8              // Slots searched for a key before giving up or evicting
+#define MEMO_EVICT_NONE 0         // A full probe window keeps its entries; new results are not cached
+#define MEMO_EVICT_LRU 1          // A full probe window drops its least recently used entry
+
+typedef struct MemoTable
+{
+    int in;            // Input cells forming the key
+    int out;           // Result cells
+    int capacity;      // Entries (a power of two)
+    int evict;         // MEMO_EVICT_NONE or MEMO_EVICT_LRU
+    Cell *entries;     // capacity entries of 1 + in + out cells: last use (0 = empty), key, results
+    Cell clock;        // Use counter for LRU
+    long hits;         // Calls answered from the cache
+    long misses;       // Calls that ran the definition
+    long evictions;    // Entries dropped to make room
+} MemoTable;
+
 // Word dictionary entry - Represents both built-in and user-defined words
 typedef struct Word
 {
@@ -30,19 +177,259 @@ typedef struct Word
     Cell *code;                  // Code array for user-defined words (NULL for built-ins)
     int code_size;               // Number of cells in code array
     int immediate;               // 1 = execute immediately even in compile mode, 0 = normal
-    struct Word *next;           // Linked list pointer (currently unused)
+    int frame_size;              // Number of frame slots allocated per call (optimizer registers)
+    RegInsn *rcode;              // Register VM translation (NULL if not available)
+    int rcode_size;              // Number of register VM instructions
+    int reg_count;               // Virtual registers used by the register VM translation
+    int backend;                 // BACKEND_DEFAULT, BACKEND_STACK or BACKEND_REGISTER
+    int pure;                    // 1 = result depends only on the data stack (no I/O or memory)
+    long calls;                  // Executions counted while profiling (--pgo-profile)
+    int code_field;              // How the word runs (CODE_COLON, CODE_CREATE, CODE_DOES, ...)
+    Cell param;                  // Data address or constant value of data words
+    struct Word *does;           // Shared DOES> behaviour of CODE_DOES words (not in the dictionary)
+    MemoTable *memo;             // Result cache of MEMO: words (NULL = not memoized)
+    int spawns;                  // 1 = calls SPAWN, so it waits for its children before returning
+    struct Word *next;           // Next compiled quotation (unused for dictionary words)
 } Word;
 
+// Quotations - Anonymous definitions [: ... ;] nested in a colon definition
+#define QUOTE_MAX_NEST 8      // Nesting depth of quotations (PDO bodies included)
+#define FUSE_MAX_CELLS 64     // Largest quotation body copied into fused code
+#define QUOTE_PLAIN 0         // Started by [:
+#define QUOTE_PDO 1           // Body of a PDO loop
+
+// Enclosing definition of a quotation being compiled
+typedef struct
+{
+    int kind;         // QUOTE_PLAIN or QUOTE_PDO
+    Word *outer;      // Definition the quotation appears in
+    int start;        // Code offset of the quotation body in code_buffer
+    int branch_top;   // Branch stack top at [:
+    int case_sp;      // case_sp at [:
+    int local_base;   // First local visible in the enclosing definition
+} QuoteFrame;
+
+// Multitasking - Cooperative round-robin tasks and coroutines, each with its own stacks and C stack
+#define TASK_MAX 64                  // Tasks and coroutines including the operator (task 0, the REPL)
+#define TASK_C_STACK (512 * 1024)    // Bytes of C stack per task
+
+typedef struct Task
+{
+    ucontext_t context; // Where the task continues when it is switched back in
+    char *c_stack;      // C stack of the task (allocated by its first ACTIVATE)
+    Stack data;         // Data stack while switched out
+    Stack ret;          // Return stack (DO loop state, >R) while switched out
+    Stack frame;        // Frame slots while switched out
+    Word *xt;           // Word the task runs
+    int active;         // Task: 1 = takes turns at PAUSE; coroutine: 1 = started and not finished
+    int coroutine;      // 1 = runs only when resumed, never scheduled by PAUSE
+    struct Task *top;   // Task: context running for it (itself or the innermost coroutine it resumed)
+    struct Task *caller; // Coroutine: context that resumed it (NULL = not running)
+    Cell value;         // Coroutine: cell passed by the last YIELD
+    int parked;         // Task: 1 = waiting for an fd or a timer, skipped by PAUSE
+    int wait_fd;        // Task: fd it waits on while parked (-1 = none)
+    long long wake_at;  // Task: CLOCK_MONOTONIC milliseconds at which a timer wakes it (0 = none)
+    long steps_left;    // Steps it may still take under STEP-LIMIT
+} Task;
+
+extern Task *tasks[TASK_MAX];
+extern int task_count;
+extern int task_current;
+
+// Parallel loops - PDO ... PLOOP bodies run on a pool of worker threads
+#define POOL_MAX_THREADS 64        // Threads of a parallel loop, the calling one included
+#define PDO_MIN_CHUNK 16           // Fewest iterations worth giving a thread of their own
+#define PDO_CHUNKS_PER_THREAD 8    // Chunks the range is cut into per thread, for load balance
+#define PDO_REDUCE_NONE 0          // PLOOP
+#define PDO_REDUCE_SUM 1           // PLOOP-SUM
+#define PDO_REDUCE_MIN 2           // PLOOP-MIN
+#define PDO_REDUCE_MAX 3           // PLOOP-MAX
+
+// Worker threads, and the job they run when woken
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;           // Signalled when a job is dispatched
+    pthread_cond_t done;           // Signalled when the last worker finishes
+    long generation;               // Jobs dispatched so far
+    int size;                      // Worker threads started (the calling thread not counted)
+    int threads;                   // Threads taking part in the current job, the caller included
+    int pending;                   // Workers still running the current job
+    void (*job)(void *arg, int id); // Current job, run as thread id
+    void *arg;                     // Its argument
+} ParallelPool;
+
+// One parallel loop
+typedef struct
+{
+    Word *body;                    // Loop body, compiled as a quotation
+    Cell limit;                    // First index not run
+    Cell next;                     // Next index to hand out (taken atomically)
+    Cell grain;                    // Indices taken at a time
+    int reduce;                    // PDO_REDUCE_*
+    int failed;                    // Set when an iteration fails; the other threads stop
+    int ok;                        // Result of the calling thread's share
+    Cell results[POOL_MAX_THREADS]; // Partial reduction of each thread
+} ParallelJob;
+
+extern ParallelPool pool;
+extern int parallel_active;
+extern int pdo_threads;
+extern Stack pdo_data;
+extern Stack pdo_ret;
+
+// Spawned children - n xt SPAWN queues xt with a copy of the top n cells, SYNC collects them
+#define SPAWN_MAX_CELLS 8          // Cells passed to a child, and cells it may leave
+#define SPAWN_MAX 1024             // Unsynced children per thread (deque size, a power of two)
+
+// A child waiting in, or taken from, a work-stealing deque
+typedef struct
+{
+    Word *body;                    // Word to run
+    int nargs;                     // Cells copied from the spawner's stack
+    Cell args[SPAWN_MAX_CELLS];
+    int nresults;                  // Cells the body left
+    Cell results[SPAWN_MAX_CELLS];
+    int failed;                    // 1 if the body reported an error or left a bad stack
+    int done;                      // Set (release) once the results are in
+} SpawnChild;
+
+// Chase-Lev deque: its thread pushes and takes children at the bottom, idle threads steal at the top
+typedef struct
+{
+    long top;                      // Oldest child (advanced by thieves with CAS)
+    char pad[64 - sizeof(long)];   // Keeps the thieves' line apart from the owner's
+    long bottom;                   // One past the newest child (written by the owner only)
+    SpawnChild *items[SPAWN_MAX];
+} SpawnDeque;
+
+extern SpawnDeque spawn_deques[POOL_MAX_THREADS];
+extern int spawn_region;
+extern __thread int pool_id;
+extern __thread int spawn_sp;
+extern __thread int spawn_base;
+
+// Channels - Bounded lock-free queues passing cells between tasks and threads
+#define CHANNEL_MAX 256                 // Channels that can be created
+#define CHANNEL_MAX_CAPACITY (1 << 20)  // Largest capacity in cells
+
+// One cell of a channel's ring; seq says whose turn the slot is
+typedef struct
+{
+    long seq;                      // Position it can be sent to, or position + 1 once it holds a cell
+    Cell value;
+} ChannelSlot;
+
+// Multi-producer multi-consumer ring buffer; senders and receivers claim positions with one
+// CAS per batch, and each end sits on its own cache line
+typedef struct
+{
+    long mask;                     // Capacity - 1 (the capacity is a power of two)
+    char pad0[64 - sizeof(long)];
+    long tail;                     // Next position to send to
+    char pad1[64 - sizeof(long)];
+    long head;                     // Next position to receive from
+    char pad2[64 - sizeof(long)];
+    ChannelSlot slots[];
+} Channel;
+
+extern Channel *channels[CHANNEL_MAX];
+extern int channel_count;
+
+// Event loop - Tasks parked on file descriptors and timers, woken through epoll
+#define EVENT_BATCH 64                  // Readiness events taken per epoll_wait
+
+extern int event_fd;
+extern int event_waiting;
+
+// Asynchronous file I/O - Reads and writes queued on an io_uring, straight into memory[]
+#define URING_ENTRIES 64               // Submission queue entries (the completion queue has twice as many)
+
+// The mapped rings of the io_uring instance
+typedef struct
+{
+    int fd;                            // io_uring file descriptor (-1 = not set up yet)
+    unsigned entries;                  // Submission queue entries
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;         // Submission queue entries, indexed through sq_array
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;         // Completions
+    unsigned queued;                   // Requests queued but not yet submitted
+    unsigned in_flight;                // Requests submitted and not yet completed
+} Uring;
+
+extern Uring uring;
+
+// Instruction budget - Steps counted at backward branches and calls
+extern __thread long step_budget;      // Steps left before step_expired() runs
+extern __thread long step_grant;       // Budget given by the last step_refill()
+extern __thread int step_aborted;      // 1 while a word stopped by STEP-LIMIT unwinds
+extern long time_slice;                // Steps per turn before a task is preempted (0 = never)
+extern long step_limit;                // Steps a command or task may take in all (0 = unlimited)
+
+// Profile-guided code layout - Compiled code lives in one code space, hot words first
+#define CODE_SPACE_SIZE (256 * STACK_SIZE) // Cells of contiguous code space for word bodies
+#define PGO_MAX_EDGES 4096                 // Caller/callee pairs counted while profiling
+
+// Caller/callee call count recorded while profiling
+typedef struct
+{
+    Word *caller;  // Calling word (NULL = unused entry)
+    Word *callee;  // Called word
+    long count;    // Number of calls
+} PgoEdge;
+
+// Placement of a word's code reserved from a loaded profile
+typedef struct
+{
+    char name[MAX_WORD_LEN];  // Word the slot is reserved for
+    long calls;               // Executions in the training run
+    int size;                 // Code cells in the training run
+    int offset;               // Offset in code_space (-1 = cold, no reserved slot)
+    int next;                 // Next slot in the same layout chain (-1 = none)
+    int head;                 // First slot of the chain this slot belongs to
+    int used;                 // 1 = a word has been placed here
+} PgoSlot;
+
+// Dictionary hash table - Open addressing over the names, for lookups without a lock
+#define DICT_TABLE_MIN 64    // Slots of the first table (a power of two)
+
+// A table is never resized in place: a larger copy is published and this one retired
+typedef struct DictTable
+{
+    int size;                // Slots (a power of two, kept at least twice the words)
+    int count;               // Words hashed
+    long retired;            // Epoch in which it was replaced
+    struct DictTable *next;  // Next retired table waiting to be freed (execution tokens: the table it replaced)
+    Word *slots[];           // Words by hash of their name, NULL = free
+} DictTable;
+
 // Dictionary structure - Contains all defined words (built-in and user-defined)
+// Readers never lock: new words and tables are published with release stores, and a
+// replaced table is freed once every thread has left the epoch it could have been read in
 typedef struct
 {
     Word *words[DICT_SIZE];  // Array of word pointers
     int count;               // Number of words currently in dictionary
+    DictTable *table;        // Current hash table
+    DictTable *xts;          // Execution tokens: every word and quotation, hashed by address
+    DictTable *retired;      // Replaced tables not yet freed
+    long epoch;              // Advanced each time a table is replaced
+    long readers[POOL_MAX_THREADS]; // Epoch each pool thread is looking up in (0 = none)
+    pthread_mutex_t lock;    // Serializes definers
 } Dictionary;
 
 // Global interpreter state - Core data structures accessible throughout the program
-extern Stack data_stack;             // Main data stack for computation
-extern Stack return_stack;           // Return stack for loops and control flow
+extern __thread Stack data_stack;    // Main data stack for computation (PDO workers have their own)
+extern __thread Stack return_stack;  // Return stack for loops and control flow
+extern __thread Stack frame_stack;   // Per-call frame slots for user-defined words
+extern __thread long error_count;    // Errors reported on this thread
+extern int case_sp;                  // Top of the case-endcase compilation stack
+extern Word *does_definer;           // Defining word whose DOES> behaviour is being compiled
+extern int local_count;              // Locals declared in the definition being compiled
+extern int local_base;               // First local visible in the innermost definition
+extern int quote_sp;                 // Top of the quotation nesting stack
+extern QuoteFrame quote_stack[QUOTE_MAX_NEST]; // Enclosing definitions of the quotations being compiled
 extern Dictionary dict;              // Dictionary of all defined words
 extern Cell memory[STACK_SIZE];      // Linear memory array for variables
 extern int base;                     // Number base for input/output (10 = decimal)
@@ -50,6 +437,7 @@ extern int state;                    // Interpreter state: 0=interpreting, 1=com
 extern Cell code_buffer[STACK_SIZE]; // Temporary buffer for compiling user-defined words
 extern int code_sp;                  // Current position in code buffer
 extern Word *current_word;           // Word currently being defined (NULL when not compiling)
+extern int vm_backend;               // Global execution backend (BACKEND_STACK or BACKEND_REGISTER)
 
 // Control flow structures - Support for compiling conditional and looping constructs
 
@@ -63,6 +451,8 @@ typedef enum
     CF_DO,      // Start of do-loop
     CF_UNTIL,   // Until condition (unused)
     CF_REPEAT,  // Repeat in begin-while-repeat (unused)
+    CF_CASE,    // Start of case-endcase
+    CF_OF,      // Of clause waiting for its endof
     CF_END      // End marker
 } ControlFlowType;
 
@@ -89,6 +479,43 @@ extern BranchStack branch_stack;
 #define OP_DO -4       // Setup for DO loop (pushes index and limit to return stack)
 #define OP_LOOP -5     // LOOP construct (increments index, tests limit, branches back)
 #define OP_J -6        // Access second loop index (currently unused)
+#define OP_PICK -7     // Copy the n-th stack item to the top (next OP_LIT cell contains n)
+#define OP_SLIDE -8    // Remove r items below the top n (two OP_LIT cells: r, then n)
+#define OP_RGET -9     // Push a frame slot of the current call (next OP_LIT cell contains slot)
+#define OP_RSET -10    // Pop into a frame slot of the current call (next OP_LIT cell contains slot)
+#define OP_SHL -11     // Multiply by a power of two (next OP_LIT cell contains the shift count)
+#define OP_DIVP2 -12   // Divide by a power of two, rounding toward zero (OP_LIT shift count)
+#define OP_MODP2 -13   // Remainder of division by a power of two (OP_LIT shift count)
+#define OP_DIVK -14    // Divide by a constant using a multiply-high (OP_LIT magic_divisors index)
+#define OP_MODK -15    // Remainder by a constant using a multiply-high (OP_LIT magic_divisors index)
+#define OP_LOOPK -16   // LOOP stepping by a constant (two OP_LIT cells: offset, then step)
+#define OP_JTAB -17    // Jump table on the top of stack (OP_LIT default offset, OP_LIT min, OP_LIT count)
+#define OP_BSEARCH -18 // Binary search on the top of stack (OP_LIT default offset, OP_LIT case_keys index,
+                       // OP_LIT count); both are followed by count OP_BRANCH entries
+#define OP_DOES -19    // Give the latest CREATEd word a DOES> behaviour (next OP_LIT cell contains the Word *)
+#define OP_COMPILE -20 // Append a word to the definition being compiled (next OP_LIT cell contains the Word *)
+#define OP_MAP -21     // MAP with a quotation known at compile time (next OP_LIT cell contains the Word *)
+#define OP_REDUCE -22  // REDUCE with a quotation known at compile time (OP_LIT Word *)
+#define OP_FOR_EACH -23 // FOR-EACH with a quotation known at compile time (OP_LIT Word *)
+
+// Loop unrolling limits - DO loops with literal bounds and a single-block body
+#define UNROLL_FULL_TRIPS 16   // Largest trip count unrolled completely
+#define UNROLL_FACTOR 4        // Body copies per iteration of a partially unrolled loop
+#define UNROLL_MAX_CELLS 128   // Largest unrolled body in cells
+#define UNROLL_PASSES 3        // Passes, so loops whose inner loop was unrolled are unrolled too
+
+// Strength reduction - Reciprocal multipliers for division by constants
+#define MAGIC_MAX 256  // Distinct constant divisors with a reciprocal multiplier
+
+typedef struct
+{
+    Cell divisor;     // The constant divisor (never 0, 1, -1 or a power of two)
+    Cell multiplier;  // Signed magic number: high half of n * multiplier approximates n / divisor
+    int shift;        // Arithmetic right shift applied after the multiply-high
+} MagicDivisor;
+
+extern MagicDivisor magic_divisors[MAGIC_MAX];
+extern int magic_count;
 
 // Control flow word implementations - Functions for compiling conditional and looping constructs
 void if_word(void);     // Compile IF (conditional branch)
@@ -101,21 +528,150 @@ void repeat_word(void); // Complete begin-while-repeat loop
 void end_word(void);    // Placeholder for ending definitions
 void do_word(void);     // Start counted DO loop
 void loop_word(void);   // End DO loop with increment/test
+void case_word(void);   // Start case-endcase
+void of_word(void);     // Compile an OF clause test
+void endof_word(void);  // End an OF clause
+void endcase_word(void); // Finish case-endcase, choosing a table or binary search dispatch
+Cell case_dispatch(Cell op, Cell x, Cell base, Cell count); // Entry for x in OP_JTAB/OP_BSEARCH, -1 = default
 void i_word(void);      // Access current loop index (DO loop)
 void j_word(void);      // Access outer loop index (nested DO loops)
 
 
+// Optimizer IR - Stack-to-SSA intermediate representation used at semicolon time
+#define IR_MAX_NODES (2 * STACK_SIZE)  // Maximum number of SSA values per segment
+
+// Decoded instruction of a threaded code array
+typedef struct
+{
+    int pos;         // Offset of the instruction in the code array
+    int len;         // Number of cells occupied (opcode plus inline operands)
+    Cell op;         // Opcode, word pointer or small literal
+    Cell arg[3];     // Inline operands (literal value, branch offset, slot index)
+    int target;      // Instruction index of the branch target (-1 if not a branch)
+} Insn;
+
+// Kinds of SSA values
+typedef enum
+{
+    IR_CONST,   // Compile-time constant
+    IR_ENTRY,   // Stack slot live on entry to the segment (0 = top)
+    IR_REG,     // Frame slot read
+    IR_OP       // Result of a pure built-in word
+} IRKind;
+
+// SSA value - stack slots of a straight-line segment become values like these
+typedef struct
+{
+    IRKind kind;     // What the value is
+    Cell value;      // Constant value, entry slot index or frame slot
+    Cell op;         // Word pointer for IR_OP values
+    int args[3];     // Operand value ids for IR_OP values (deepest first)
+    int nargs;       // Number of operands
+    int reg;         // Frame slot holding a hoisted copy of the value (-1 if none)
+} IRNode;
+
+// Straight-line segment lifted into SSA form by symbolic execution
+typedef struct
+{
+    IRNode nodes[IR_MAX_NODES];  // SSA values in creation order
+    int count;                   // Number of values
+    int stack[STACK_SIZE];       // Symbolic stack of value ids (bottom to top)
+    int sp;                      // Symbolic stack pointer (-1 = empty)
+    int depth;                   // Number of entry slots consumed from below the segment
+    int cost;                    // Dispatches taken by the original instructions
+} IRSegment;
+
+// Lowering roles - what an item of the modelled stack is while a segment is lowered
+typedef enum
+{
+    ROLE_KEPT,   // Entry slot the segment leaves in place
+    ROLE_ENTRY,  // Entry slot not yet consumed (removed by OP_SLIDE if left over)
+    ROLE_TEMP,   // Operand waiting to be consumed by an operation
+    ROLE_OUT     // Final output of the segment
+} IRRole;
+
+// Item of the modelled stack during lowering
+typedef struct
+{
+    int node;      // SSA value held by the item
+    IRRole role;   // What the item is used for
+} IRItem;
+
+// Output buffer for lowered code
+typedef struct
+{
+    Cell *code;    // Destination cells
+    int size;      // Cells written
+    int cap;       // Capacity of the destination
+    int cost;      // Dispatches the emitted code takes
+    int failed;    // 1 = lowering gave up (overflow or unsupported shape)
+} IREmitter;
+
+// Built-in words the optimizer can evaluate symbolically
+typedef struct
+{
+    void (*func)();  // Built-in implementation
+    int nargs;       // Number of cells consumed (one result is produced)
+    int divides;     // 1 = traps on a zero top operand, only modelled for constants other than 0 and -1
+} PureOp;
+
+// Stack shuffles modelled as permutations of their inputs
+typedef struct
+{
+    void (*func)();  // Built-in implementation
+    int nin;         // Number of cells consumed
+    int nout;        // Number of cells produced
+    int out[6];      // Input index (deepest first) for each produced cell
+} ShuffleOp;
+
+// Pure built-ins with a dedicated register VM opcode
+typedef struct
+{
+    void (*func)();  // Built-in implementation
+    int op;          // Register form (RV_ADD...RV_OR); op + RV_CONST_OFFSET is the constant form
+} RegBinary;
+
+// Strength reduction - Cheaper forms of *, / and mod by constants
+Cell strength_reduce(void (*func)(), Cell c, Cell *arg); // Pick OP_SHL/DIVP2/MODP2/DIVK/MODK (0 = none)
+Cell div_pow2(Cell n, Cell k);                  // n / 2^k rounding toward zero
+Cell mod_pow2(Cell n, Cell k);                  // n mod 2^k with the sign of n
+Cell div_magic(Cell n, const MagicDivisor *m);  // n / divisor via multiply-high
+Cell apply_reduced(Cell op, Cell n, Cell arg);  // Run one OP_SHL .. OP_MODK operation
+int reduce_code(Cell *code, int size);          // Rewrite literal *, / and mod in place
+
 // Data stack operations - Core functions for manipulating the data stack
 void stack_push(Cell value);  // Push value onto data stack
 Cell stack_pop(void);         // Pop and return top value from data stack
 Cell stack_peek(void);        // Return top value without removing it
 int stack_empty(void);        // Check if data stack is empty
 int stack_full(void);         // Check if data stack is full
+int stack_check(int in, int out); // Check room before rewriting the top items in place
+void stack_pick(Cell n);      // Copy the n-th item below the top
+void stack_slide(Cell r, Cell n); // Remove r items below the top n
 
 // Dictionary management - Functions for maintaining the word dictionary
 void dict_init(void);           // Initialize dictionary structure
 Word *dict_find(const char *name); // Search for word by name
 void dict_add(Word *word);      // Add new word to dictionary
+Word *dict_find_builtin(void (*func)()); // Find a built-in word by its function
+unsigned dict_hash(const char *name); // Hash of a word name
+DictTable *dict_table_new(int size); // Allocate an empty hash table
+void dict_table_insert(DictTable *table, Word *word); // Hash a word unless its name is taken
+void dict_reclaim(void);        // Free retired tables no thread can still be reading
+unsigned xt_hash(const Word *word); // Hash of a word's address
+void xt_table_insert(DictTable *table, Word *word); // Hash a word by its address
+int dict_table_reserve(DictTable **slot, void (*insert)(DictTable *table, Word *word)); // Grow a table that would get too full
+int xt_add(Word *word);         // Register an execution token outside the dictionary
+Word *xt_find(Cell xt);         // Look up an execution token
+Word *word_new(const char *name);   // Allocate a user-defined word with default fields
+int is_data_word(const Word *word); // Check whether a word only pushes its param
+
+// Code space and profile-guided layout
+extern int pgo_profiling;                   // 1 = count calls for --pgo-profile
+Cell *code_alloc(const char *name, int size); // Allocate a word body (profile slot if reserved)
+void pgo_count_edge(Word *caller, Word *callee); // Count one call from caller to callee
+int pgo_save(const char *path);             // Write the collected profile, return 1 on success
+int pgo_load(const char *path);             // Read a profile and reserve the hot code layout
 
 // Error handling - Non-fatal error recovery mechanism
 void error(const char *msg);    // Print error and reset interpreter state
@@ -124,6 +680,14 @@ void error(const char *msg);    // Print error and reset interpreter state
 void mem_store(int addr, Cell value); // Store value at memory address
 Cell mem_fetch(int addr);       // Retrieve value from memory address
 
+// Atomic memory operations - Cells shared between threads
+Cell *atomic_cell(Cell addr);   // Check an address for an atomic access
+void atomic_fetch_word(void);   // Fetch atomically (ATOMIC@)
+void atomic_store_word(void);   // Store atomically (ATOMIC!)
+void atomic_add_word(void);     // Add atomically (ATOMIC+!)
+void cas_word(void);            // Compare and swap (CAS)
+void fence_word(void);          // Full memory fence (FENCE)
+
 // Input/Output operations - Functions for displaying data and debugging
 void print_cell(Cell value);    // Print a single cell value
 void print_stack(void);         // Display entire data stack contents
@@ -132,6 +696,37 @@ void cr(void);                  // Print carriage return (newline)
 // Word definition - Compiler directives for creating user-defined words
 void colon(void);               // Start word definition (:)
 void semicolon(void);           // End word definition (;)
+void finish_definition(Word *word); // Optimize code_buffer and install it as the word's code
+int compile_word(Word *word);   // Append a word reference (or a data word's value) to code_buffer
+
+// Compile-time words - Interpreting inside definitions, literals and deferred compilation
+void left_bracket_word(void);   // Interpret inside a definition ([)
+void right_bracket_word(void);  // Resume compiling (])
+void literal_word(void);        // Compile the top of the stack as a literal (LITERAL)
+void postpone_word(void);       // Compile the compilation behaviour of the next word (POSTPONE)
+void immediate_word(void);      // Mark the latest word immediate (IMMEDIATE)
+
+// Locals - {: a b | c -- :} declares frame slots read by name and written with TO
+void locals_word(void);         // Declare locals and pop the initialized ones ({:)
+void to_word(void);             // Compile a store into a local (TO)
+int local_find(const char *name); // Frame slot of a local, -1 if not declared
+int compile_local(Cell op, int slot); // Append OP_RGET/OP_RSET slot to code_buffer
+
+// Quotations and execution tokens - An execution token is the Word * of a word or quotation
+void quotation_begin(int kind); // Start an anonymous definition (QUOTE_PLAIN or QUOTE_PDO)
+int quotation_end(int kind);    // Finish it and compile its execution token
+void quotation_word(void);      // Start an anonymous definition ([:)
+void end_quotation_word(void);  // Finish it and compile its execution token (;])
+void tick_word(void);           // Push the execution token of the next word (')
+void execute_xt_word(void);     // Run an execution token (EXECUTE)
+void map_word(void);            // Replace each cell of a range by xt applied to it (MAP)
+void reduce_word(void);         // Fold a range with xt (REDUCE)
+void for_each_word(void);       // Apply xt to each cell of a range (FOR-EACH)
+Word *xt_word(Cell xt);         // Validate an execution token
+int range_valid(Cell addr, Cell n); // Check a memory range of MAP, REDUCE and FOR-EACH
+int byte_range_valid(Cell addr, Cell n); // Check a buffer of bytes packed in memory
+void range_apply(Cell op, Word *w); // Run OP_MAP, OP_REDUCE or OP_FOR_EACH with a word
+int fuse_quotations(Cell *code, int size); // Inline literal quotations into EXECUTE/MAP/REDUCE/FOR-EACH
 
 // Input processing state - Variables for parsing input text during tokenization
 extern char *current_input;  // Current input line being processed
@@ -141,12 +736,148 @@ extern int next_mem_addr;    // Next available memory address for variables
 // Input processing - Functions for parsing and tokenizing input text
 char *tokenize(char *token);    // Extract next token from input stream
 
+// Optimizer - Lift compiled code to SSA, optimize and lower back to threaded code
+int insn_decode(const Cell *code, int pos, Insn *insn); // Decode one instruction
+int is_word_pointer(Cell item); // Check whether a code cell is a Word pointer
+int optimize_code(Cell *code, int size, int *frame_size); // Optimize code in place, return new size
+int partial_eval(Cell *code, int size); // Fold pure calls with literal arguments, return new size
+int code_is_pure(const Cell *code, int size); // Check whether code only touches the data stack
+int unroll_loops(Cell *code, int size); // Unroll DO loops with literal bounds, return new size
+
 // Word execution - Core execution engine for both built-in and user-defined words
 void execute_word(Word *word);  // Execute a word by name or reference
+void execute_code(Word *word);  // Run a user-defined word's code on its backend
+void execute_registers(Word *word); // Execute a word's register VM translation
+void compile_registers(Word *word); // Translate a word's threaded code for the register VM
 
 // Defining words - Special words that create new words in the dictionary
 void variable_word(void);      // Create a variable (pushes address)
 void constant_word(void);      // Create a constant (pushes fixed value)
+void create_word(void);        // Create a word that pushes its data address
+void does_word(void);          // Start the DOES> behaviour of a defining word
+void does_bind(Word *behaviour); // Give the latest CREATEd word a DOES> behaviour
+void comma_word(void);         // Compile a cell into data memory (,)
+void defer_word(void);         // Create a deferred word (DEFER)
+void is_word(void);            // Set the action of a deferred word (IS)
+void action_of_word(void);     // Get the action of a deferred word (ACTION-OF)
+void defer_fetch_word(void);   // Action of a deferred word given as an xt (DEFER@)
+void defer_store_word(void);   // Set the action of a deferred word given as an xt (DEFER!)
+int defer_set(Word *defer, Cell xt); // Point a deferred word at an xt, 1 on success
+Word *defer_name(const char *missing); // Read the name of a deferred word
+void defer_compile(Word *defer, void (*func)()); // Compile IS or ACTION-OF inside a definition
+void recurse_word(void);       // Compile a call to the word being defined (RECURSE)
+
+// Memoization - MEMO: definitions cache their results by input cells
+MemoTable *memo_new(int in, int out, int capacity); // Allocate an empty cache
+void memo_execute(Word *word);  // Run a MEMO: word through its cache
+unsigned long long memo_hash(const Cell *key, int n); // Hash of a key's input cells
+Cell *memo_find(MemoTable *memo, const Cell *key); // Cached entry for a key, NULL if absent
+void memo_insert(MemoTable *memo, const Cell *key, const Cell *results); // Cache a result
+Word *memo_name(void);          // Read the name of a MEMO: word from the input
+void memo_colon_word(void);     // Start a memoized definition (MEMO:)
+void memo_capacity_word(void);  // Resize and clear a cache (MEMO-CAPACITY)
+void memo_evict_word(void);     // Select the eviction policy (MEMO-EVICT)
+void memo_stats_word(void);     // Push hits, misses and evictions (MEMO-STATS)
+void memo_clear_word(void);     // Empty a cache and reset its counters (MEMO-CLEAR)
+
+// Multitasking - TASK, ACTIVATE, PAUSE and STOP; coroutines with START, RESUME and YIELD
+void stack_copy(Stack *to, const Stack *from); // Copy the live cells of a stack
+Task *task_get(Cell id, int coroutine); // Task or coroutine for a number, NULL after reporting an error
+int task_next(void);            // Next active task after the current one
+void context_switch(Task *from, Task *to); // Save one context's stacks and resume another
+void task_switch(int to);       // Suspend the current task and resume another
+int task_start(Task *task, Word *xt); // Prepare a context to run a word from the start
+void task_unwind(Task *task);   // Abandon the coroutines a task is running
+void task_entry(void);          // First code run on a task's C stack
+void task_create(int coroutine); // Create a task or coroutine and its word
+void task_word(void);           // Create a task (TASK)
+void activate_word(void);       // Start a task running a word (ACTIVATE)
+void pause_word(void);          // Give the other tasks a turn (PAUSE)
+void stop_word(void);           // End the current task (STOP)
+void coroutine_return(Task *co, int yielded); // Switch from a coroutine back to its caller
+void coroutine_word(void);      // Create a coroutine (COROUTINE)
+void start_word(void);          // Start a coroutine running a word (START)
+void resume_word(void);         // Run a coroutine to its next YIELD (RESUME)
+void yield_word(void);          // Pass a value to the resumer and suspend (YIELD)
+
+// Parallel loops - PDO ... PLOOP and the worker pool
+void *pool_worker(void *arg);   // Thread function of a pool worker
+int pool_threads(void);         // Threads a parallel loop may use, starting workers as needed
+void pool_run(void (*job)(void *arg, int id), void *arg, int threads); // Run a job on several threads
+Cell pdo_identity(int reduce);  // Result of an empty reduction
+Cell pdo_combine(int reduce, Cell a, Cell b); // Combine two partial results
+int pdo_run(ParallelJob *job, int id); // Run chunks of a loop on the calling thread
+void pdo_thread(void *arg, int id); // Pool job of a parallel loop
+void pdo_run_word(void);        // Run a parallel loop ((PDO))
+void pdo_word(void);            // Start a parallel loop body (PDO)
+void ploop_end(int reduce);     // Compile a parallel loop
+void ploop_word(void);          // End a parallel loop (PLOOP)
+void ploop_sum_word(void);      // End a parallel loop with a sum (PLOOP-SUM)
+void ploop_min_word(void);      // End a parallel loop with a minimum (PLOOP-MIN)
+void ploop_max_word(void);      // End a parallel loop with a maximum (PLOOP-MAX)
+void pdo_threads_word(void);    // Set the threads of parallel loops (PDO-THREADS)
+
+// Spawned children - SPAWN and SYNC on work-stealing deques
+void deque_push(SpawnDeque *dq, SpawnChild *child); // Add a child at the bottom (owner only)
+SpawnChild *deque_take(SpawnDeque *dq); // Remove the newest child (owner only)
+SpawnChild *deque_steal(SpawnDeque *dq); // Remove the oldest child (any thread)
+void spawn_run(SpawnChild *child); // Run a child on the calling thread's stacks
+int spawn_steal(void);          // Run a child stolen from another thread
+void spawn_thread(void *arg, int id); // Pool job of a word that spawns
+void spawn_scope(Word *word);   // Run a word that spawns, then sync its children
+int code_calls(const Cell *code, int size, void (*func)()); // Check whether code calls a builtin
+void spawn_word(void);          // Queue a child (SPAWN)
+void sync_word(void);           // Wait for the running word's children (SYNC)
+
+// Channels - CHANNEL, >CHAN, CHAN> and their batched and non-blocking forms
+Channel *channel_get(Cell id);  // Look up a channel by number
+int channel_send(Channel *ch, const Cell *cells, int n); // Send as many cells as fit now
+int channel_receive(Channel *ch, Cell *cells, int n); // Receive as many cells as are there now
+int channel_wait(const char *deadlock); // Let a sender or receiver on the other end run
+void channel_word(void);        // Create a channel (CHANNEL)
+void to_chan_word(void);        // Send a cell (>CHAN)
+void from_chan_word(void);      // Receive a cell, waiting for one (CHAN>)
+void try_from_chan_word(void);  // Receive a cell if there is one (?CHAN>)
+void to_chan_n_word(void);      // Send cells from memory (>CHAN-N)
+void from_chan_n_word(void);    // Receive cells into memory (CHAN-N>)
+
+// Event loop - I/O and timers that park the current task instead of blocking
+long long clock_ms(void);       // Monotonic time in milliseconds
+int event_init(void);           // Create the epoll set on first use
+void event_wake(Task *task);    // Make a parked task runnable again
+void event_poll(int block);     // Wake the tasks whose fds are ready or timers are due
+int task_next_ready(void);      // Pick the next task, waiting for events if all are parked
+int event_park(int fd, int events, long long wake_at); // Park the current task until woken
+int fd_wait(int fd, short events); // Wait until an fd is ready, letting other tasks run
+void read_fd_word(void);        // Read bytes into memory (READ-FD)
+void write_fd_word(void);       // Write bytes from memory (WRITE-FD)
+void wait_readable_word(void);  // Wait until an fd can be read (WAIT-READABLE)
+void ms_word(void);             // Sleep, letting other tasks run (MS)
+void after_word(void);          // Activate a task after a delay (AFTER)
+void pipe_word(void);           // Create a pipe (PIPE)
+void close_fd_word(void);       // Close an fd (CLOSE-FD)
+
+// Asynchronous file I/O - io_uring requests on byte buffers in memory[]
+int uring_init(void);           // Set up the rings on first use
+int uring_submit(void);         // Submit the queued requests
+void uring_queue(int opcode);   // Queue a read or a write
+int uring_reap(void);           // Push one completion if there is one
+void open_file_word(void);      // Open a file by a name in memory (OPEN-FILE)
+void uring_read_word(void);     // Queue a read (URING-READ)
+void uring_write_word(void);    // Queue a write (URING-WRITE)
+void uring_submit_word(void);   // Submit queued requests (URING-SUBMIT)
+void uring_poll_word(void);     // Take a completion if there is one (URING-POLL)
+void uring_wait_word(void);     // Wait for a completion (URING-WAIT)
+unsigned char *byte_at(Cell addr, Cell i); // Check a byte position in a buffer
+void byte_fetch_word(void);     // Fetch a byte of a buffer (BYTE@)
+void byte_store_word(void);     // Store a byte of a buffer (BYTE!)
+
+// Instruction budget - Preemption and step limits for long-running words
+void step_refill(void);         // Give the running context a new budget
+void step_begin(void);          // Start counting a command from the REPL
+int step_expired(void);         // Preempt or abort when the budget runs out
+void time_slice_word(void);     // Set the steps per turn (TIME-SLICE)
+void step_limit_word(void);     // Set the steps per command or task (STEP-LIMIT)
 
 // Utility functions - Helper functions for internal operations
 int dict_find_index(const char *name); // Find word index in dictionary (unused)